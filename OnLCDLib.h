@@ -24,6 +24,9 @@ HOW TO USE
 - Bellow in the setup section modify the setup as needed
 - In your main function, use  "LCDSetup(cursorStyle)":
 	"cursorStyle" can be: LCD_CURSOR_BLINK, LCD_CURSOR_ULINE, LCD_CURSOR_NONE
+  It waits LCD_POWER_ON_MS, resets the controller with the datasheet's
+  minimum waits and uses the busy flag from the first full command on. With
+  LCD_ASYNC (5.) it returns at once and the tick does the waiting.
 	
 2. Interfacing with LCD
 STRINGS
@@ -32,6 +35,9 @@ STRINGS
 - Send a string to a specific location. x is character position, y is line/row number.
   x and y can start from 0 or 1 depending how user prefers:
 	"LCDWriteStringXY(x, y, aString)"
+- Strings in flash do not take SRAM. A literal given to the functions above is
+  copied to SRAM at startup, use the _P versions with PSTR() instead:
+	"LCDWriteString_P(PSTR("Feed"))", "LCDWriteStringXY_P(x, y, PSTR("Feed"))"
 
 INTEGERS
 - Send a integer number:
@@ -44,9 +50,46 @@ INTEGERS
 	LCDWriteInt(ADC_results, 3);
 	will display "120".
 	You can also display negative numbers.
+	Numbers from 0 to 255 are converted without any division.
+- Send a packed BCD byte (e.g. 0x59 shows "59"), useful for clocks:
+	"LCDWriteBCD(bcd)"
 - Send a integer number to a specific location:
 	"LCDWriteIntXY(x, y, number, nr_of_digits)"
+
+FORMATTED TEXT (C++14)
+- Only for C++ code such as the host tests; C code (the firmware) uses
+  LCDFrameWriteFormat_P(). In C++ the format string is parsed by the compiler. What is left is a fixed
+  sequence of character stores and number conversions into a buffer on the
+  stack, sent byte by byte with LCDData() (no wrap, no "%0" codes) or with one
+  LCDFrameWriteString():
+	"LCDPrintf("Current:%02u:%02u:%02u", h, m, s)"
+	"LCDFramePrintf("Left: %b:%b:%b", hours_bcd, minutes_bcd, seconds_bcd)"
+  "%u" is a uint16_t, "%d" an int16_t, "%b" a packed BCD byte, "%c" a char and
+  "%%" a percent sign. A width pads with spaces ("%3u") or zeros ("%03u"),
+  the sign counts. An unknown conversion or a wrong number of arguments does
+  not compile. Numbers below 256 are converted without any division.
 	
+CUSTOM CHARACTERS
+- The 8 CGRAM slots of the LCD are loaded on demand, LCDSetup() uploads nothing.
+  A glyph is 8 rows of 5 pixels in flash and is known by its address:
+	static const uint8_t bell[8] PROGMEM = {0x04, 0x0E, 0x0E, 0x0E, 0x1F, 0x00, 0x04, 0x00};
+	LCDData(LCDGlyph(bell));
+  "LCDGlyph(glyph)" returns the char code of the slot holding the glyph and
+  uploads it first if it is not there, into a free slot or else the least
+  recently used one. Slots shown on screen or in the framebuffer are not
+  taken while another slot can be. Glyphs written directly to the screen can be replaced
+  once more than 8 others were asked for later, so ask again before reusing
+  their codes.
+- Load several glyphs (consecutive in flash) before drawing with them.
+  Missing ones in neighbouring slots share one CGRAM address command:
+	"LCDGlyphLoad(glyphs, count)"
+  e.g. LCDGlyphLoad(LCD_custom_chars, 8) before a big digits page sends the
+  whole font after one command (66 bytes) instead of 10 bytes per glyph.
+- "LCDCustomChar(n)" is LCDGlyph() for glyph n of "LCD_custom_chars" (codes 8
+  and above are returned as they are). The big digits and "%0" to "%7" in
+  strings use it.
+- An upload moves the cursor back to where it was.
+
 BIG DIGITS
 - Double height digits:
 	- Custom double height digits 1 character wide font can be found in "double_height_sharp_digits.h".
@@ -83,9 +126,71 @@ cathode to collector.
 
 3. Animations
 - Scroll a string from right to left. Needs to be uncommented in setup section:
-	"LCDScrollText(aString)"
+	"LCDScrollText(aString)", "LCDScrollText_P(PSTR(...))"
+  The text is written once into the part of the 40 character DDRAM line that
+  is not shown and the display shift moves the view over it, a command and a
+  character per step. Both rows move, the screen is cleared before and after.
+- Pages, with LCD_PAGES uncommented in setup section (1 or 2 row LCDs). A DDRAM
+  line holds page 0 and, next to it, page 1. Compose the hidden page and show
+  it when it is complete, the change is never seen half drawn:
+	"LCDPageGotoXY(page, x, y)" then the write functions, without LCD_WRAP
+	going past the end of a line (it continues on page 0)
+	"LCDPageShow(page)" - page 0 takes one command, page 1 one display shift
+	per column. "LCD_page" is the page on screen, LCDClear() shows page 0.
+- With the framebuffer, LCDFlush() draws on the page on screen and
+	"LCDFlip()"
+  draws the whole frame on the hidden page and shows it.
+	
+4. Framebuffer
+- Draw into a RAM copy of the screen and send only what changed. Define
+  LCD_FRAMEBUFFER before including this file (two copies of the screen in RAM).
+  The same x/y conventions as above apply:
+	"LCDFrameGotoXY(x, y)"
+	"LCDFrameWriteString(aString)", "LCDFrameWriteStringXY(x, y, aString)"
+	"LCDFrameWriteString_P(PSTR(...))", "LCDFrameWriteStringXY_P(x, y, PSTR(...))"
+	"LCDFrameWriteInt(number, nr_of_digits)", "LCDFrameWriteIntXY(x, y, number, nr_of_digits)"
+	"LCDFrameWriteBCD(bcd)"
+	"LCDFrameClear()"
+- A layout from a format string in flash. "%b" is a packed BCD byte, "%d" an
+  int16_t, "%%" a percent sign:
+	"LCDFrameWriteFormat_P(PSTR("Left: %b:%b:%b"), hours, minutes, seconds)"
+- Big digits into the frame, with BIG_DIGITS or BIG_DIGITS_3_CHARACTERS and
+  CUSTOM_CHARS. The digit takes the row at the frame position and the one below
+  (plus a blank column with the 3 characters font):
+	"LCDFrameWriteBigDigit(digit)", "LCDFrameWriteBigBCD(bcd)"
+	"LCDFrameWriteBigSeparator()"
+  The glyph layouts are tables in flash. Only the cells that differ from the
+  screen are sent, so a clock whose seconds tick from 08 to 09 costs a cursor
+  move and a cell or three per row of the changed digit, not a redraw.
+- Send the changed characters to the LCD. Runs of adjacent changes share one
+  cursor move:
+	"LCDFlush()"
+  Characters are copied as they are, "%" custom char codes are not parsed.
 	
-4. Utils
+5. Asynchronous transport
+- With LCD_ASYNC defined (before including this file) every function above only
+  queues its bytes and returns. Call "LCDQueueTick()" from a periodic timer
+  interrupt, every LCD_QUEUE_TICK_US microseconds. Each tick sends one byte;
+  the tick period covers the controller's execution time so the busy flag is
+  never polled. If the queue is full the caller waits for a free slot. With
+  interrupts off the tick cannot run, the caller then sends the oldest byte
+  itself after a tick period, so it is safe but slow inside an ISR.
+- If the tick only runs on demand, define LCD_QUEUE_WAIT_HOOK() to start it.
+  It is called while waiting for a free slot and in LCDQueueWait().
+- LCDSetup() only sets the pins and queues the setup commands. The tick sends
+  the reset sequence first, so the application runs from the first
+  millisecond and can draw at once; LCDQueuePending() is set until the LCD
+  has it all. Define LCD_QUEUE_TICK_US before including this file if the
+  tick is not 1 ms, the waits are counted in ticks.
+- Wait until everything queued has been sent (e.g. before stopping the timer):
+	"LCDQueueWait()"
+- Check if bytes are still waiting (e.g. to keep a tick running while sleeping):
+	"LCDQueuePending()"
+- If the CPU clock changes at run time (clock.h), define LCD_DELAY_US(us) so the
+  strobe and command delays stay long enough at every clock. LCDSetup() runs
+  at F_CPU.
+	
+6. Utils
 - Find characters positions where lines start and end. Needs to be uncommented in setup section:
   Puts an x and increments cursor position showing the current position.
   LCD_X_POS_DELAY in how fast to increment cursor.
@@ -116,7 +221,14 @@ ________________________________________________________________________________
 	INCLUDES
 **************************************************************/
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
+#include <stdarg.h>
+#include "hal.h"
+
+#ifndef LCD_DELAY_US
+#define LCD_DELAY_US(us) _delay_us(us) // Strobe and command delays, minimums
+#endif
 
 /*************************************************************
 	DEFINE SETUP
@@ -133,8 +245,12 @@ ________________________________________________________________________________
 #define LCD_RS_CONTROL_PORT PORTD 	// Port where RS, RW, E pins are	 |
 #define LCD_RW_CONTROL_PORT PORTD 	// Port where RS, RW, E pins are	 |
 #define LCD_E_CONTROL_PORT 	PORTD 	// Port where RS, RW, E pins are	 |
+#ifndef LCD_RS_PIN					// Define RS and RW before including |
 #define LCD_RS_PIN			PD0 	// Register selection signal		 |
+#endif								// this file to move them, e.g. off	 |
+#ifndef LCD_RW_PIN					// the USART pins PD0/PD1			 |
 #define LCD_RW_PIN			PD1 	// Read/write signal 				 |
+#endif								//									 |
 #define LCD_E_PIN 			PD2 	// Enable signal					 |
 //																		 |
 // LCD type																 |
@@ -158,7 +274,26 @@ ________________________________________________________________________________
 // per line on LCD, the cursor will be set on the beginning of the next line
 #define LCD_WRAP					// 									 |
 //																		 |
+// Framebuffer - RAM copy of the screen, LCDFlush() only sends changes. |
+// Uses 2 x LCD_NR_OF_CHARACTERS x LCD_NR_OF_ROWS bytes of RAM, define	 |
+// it before including this file to use it							 |
+//#define LCD_FRAMEBUFFER			// 									 |
+//																		 |
+// Asynchronous transport - define LCD_ASYNC before including this file |
+// and call LCDQueueTick() from a timer ISR. Size must be a power of 2	 |
+#define LCD_QUEUE_SIZE			32	// 									 |
+#ifndef LCD_QUEUE_TICK_US			// Define before including if the tick differs
+#define LCD_QUEUE_TICK_US		1000 // Period of LCDQueueTick() calls	 |
+#endif								//									 |
+//																		 |
+// Wait after power on before the first command. HD44780: 40 ms once Vcc|
+// reached 2.7 V, 15 ms from 4.5 V										 |
+#ifndef LCD_POWER_ON_MS				//									 |
+#define LCD_POWER_ON_MS			50	//									 |
+#endif								//									 |
+//																		 |
 // Use of custom characters (if not used comment out to save space)		 |
+// Loaded into CGRAM when first used, a slot table in RAM				 |
 //#define CUSTOM_CHARS				// 									 |
 //																		 |
 // Use of big double height digits (if not used comment out to save space)
@@ -173,6 +308,9 @@ ________________________________________________________________________________
 //#define LCD_ANIMATIONS			    //	     			                 |
 #define LCD_SCROLL_SPEED		200 // In milliseconds					 |
 //																		 |
+// Two screens in DDRAM, switched with the display shift (1 and 2 row LCDs)
+//#define LCD_PAGES					//									 |
+//																		 |
 // * Utils * (Uncomment if needed)									 	 |
 // A function used to find positions on LCD                              |
 // #define LCD_UTILS				//						  			 |
@@ -187,12 +325,24 @@ ________________________________________________________________________________
 #define LCD_CURSOR_BLINK 	0b00000011
 #define LCD_CURSOR_ULINE 	0b00000010
 #define LCD_CURSOR_NONE	 	0b00000000
+#define LCD_RETURN_HOME	 	0b00000010 // Address 0 and no display shift
+
+// Each DDRAM line holds 40 characters, the display shows a window of them
+#define LCD_DDRAM_LINE		40
+#ifdef LCD_PAGES
+	#if LCD_NR_OF_ROWS > 2 || LCD_NR_OF_CHARACTERS * 2 > LCD_DDRAM_LINE
+		#error "LCD_PAGES needs 2 pages side by side in a DDRAM line"
+	#endif
+	#define LCD_PAGE_OFFSET	LCD_NR_OF_CHARACTERS // DDRAM column of page 1
+#endif
 
 /*************************************************************
 	FUNCTION PROTOTYPES
 **************************************************************/
 void LCDSetup(uint8_t cursorStyle);
 void LCDWriteString(const char *msg);
+void LCDWriteString_P(const char *msg);
+void LCDWriteStringFrom(const char *msg, uint8_t progmem);
 void LCDWriteInt(int16_t number, int8_t nrOfDigits);
 void LCDWriteIntBig(int16_t number, int8_t nrOfDigits);
 void LCDWriteIntBig3Chars(int16_t number, int8_t nrOfDigits);
@@ -202,8 +352,43 @@ void LCDBacklightPWM(uint8_t brightness);
 void LCDByte(uint8_t, uint8_t);
 void LCDBusyLoop(void);
 void FlashEnable(void);
+void LCDWrite(uint8_t data, uint8_t isdata);
+void LCDWriteNibble(uint8_t nibble);
+// Custom characters
+uint8_t LCDGlyph(const uint8_t *glyph);
+void LCDGlyphLoad(const uint8_t *glyphs, uint8_t count);
+uint8_t LCDCustomChar(uint8_t n);
+uint8_t LCDGlyphFind(const uint8_t *glyph);
+void LCDGlyphTouch(uint8_t slot);
+// Asynchronous transport
+void LCDQueueTick(void);
+void LCDQueueWait(void);
+void LCDQueueWaitTick(void);
+uint8_t LCDQueuePending(void);
+void LCDIntToString(int16_t number, int8_t nrOfDigits, char *string);
+uint16_t LCDBinToBCD(uint8_t bin);
+void LCDWriteBCD(uint8_t bcd);
+// Framebuffer
+void LCDFrameGotoXY(uint8_t x, uint8_t y);
+void LCDFrameWriteString(const char *msg);
+void LCDFrameWriteString_P(const char *msg);
+void LCDFrameWriteStringFrom(const char *msg, uint8_t progmem);
+void LCDFrameWriteFormat_P(const char *format, ...);
+void LCDFrameWriteInt(int16_t number, int8_t nrOfDigits);
+void LCDFrameWriteBCD(uint8_t bcd);
+void LCDFrameClear(void);
+void LCDFrameWriteBigDigit(uint8_t digit);
+void LCDFrameWriteBigBCD(uint8_t bcd);
+void LCDFrameWriteBigSeparator(void);
+void LCDFlush(void);
 // Animations
 void LCDScrollText(const char *text);
+void LCDScrollText_P(const char *text);
+void LCDScrollTextFrom(const char *text, uint8_t progmem);
+// Pages
+void LCDPageGotoXY(uint8_t page, uint8_t x, uint8_t y);
+void LCDPageShow(uint8_t page);
+void LCDFlip(void);
 // Utils
 void LCDFindCharPositions(void);
 
@@ -212,7 +397,7 @@ void LCDFindCharPositions(void);
 #endif
 
 #ifdef CUSTOM_CHARS
-static const uint8_t LCD_custom_chars[] = {
+static const uint8_t LCD_custom_chars[] PROGMEM = {
 	0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, //Char0
 	0x1E, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, //Char1
 	0x1E, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1E, //Char2
@@ -224,6 +409,39 @@ static const uint8_t LCD_custom_chars[] = {
 };
 #endif
 
+// Big digit layouts: custom char codes of the top row, then of the bottom row
+#if defined(BIG_DIGITS) && defined(CUSTOM_CHARS)
+static const uint8_t LCD_big_digits[10][2] PROGMEM = {
+	{1, 5}, {0, 0}, {7, 2}, {6, 3}, {5, 0}, {2, 3}, {2, 5}, {7, 0}, {4, 5}, {4, 3}
+};
+#endif
+#if defined(BIG_DIGITS_3_CHARACTERS) && defined(CUSTOM_CHARS)
+static const uint8_t LCD_big3_digits[10][6] PROGMEM = {
+	{0, 1, 2,		3, 4, 5},		// 0
+	{1, 2, ' ',		4, 7, 4},		// 1
+	{6, 6, 2,		3, 4, 4},		// 2
+	{6, 6, 2,		4, 4, 5},		// 3
+	{3, 4, 7,		' ', ' ', 7},	// 4
+	{3, 6, 6,		4, 4, 5},		// 5
+	{0, 6, 6,		3, 4, 5},		// 6
+	{1, 1, 2,		' ', ' ', 7},	// 7
+	{0, 6, 2,		3, 4, 5},		// 8
+	{0, 6, 2,		' ', ' ', 7},	// 9
+};
+#endif
+
+// The framebuffer draws with the 3 characters font if both are enabled
+#if defined(BIG_DIGITS_3_CHARACTERS) && defined(CUSTOM_CHARS)
+#define LCD_BIG_FONT LCD_big3_digits
+#define LCD_BIG_WIDTH 3
+#define LCD_BIG_GAP 1 // Blank column after each digit, as LCDWriteIntBig3Chars
+#elif defined(BIG_DIGITS) && defined(CUSTOM_CHARS)
+#define LCD_BIG_FONT LCD_big_digits
+#define LCD_BIG_WIDTH 1
+#define LCD_BIG_GAP 0
+#endif
+#define LCD_BIG_DOT 0b10100101 // Centered dot of the A00 character ROM
+
 
 /*************************************************************
 	MACROS
@@ -231,6 +449,9 @@ static const uint8_t LCD_custom_chars[] = {
 #define LCDCmd(c) LCDByte(c, 0)  // send a command to LCD
 #define LCDData(d) LCDByte(d, 1) // send data to LCD
 
+// Character of a string in RAM or, if progmem is set, in flash
+#define LCD_STRING_CHAR(p, progmem) ((progmem) ? (char)pgm_read_byte(p) : *(p))
+
 #define LCDClear() LCDCmd(0b00000001)
 #define LCDHome() LCDCmd(0b10000000)
 
@@ -241,16 +462,47 @@ static const uint8_t LCD_custom_chars[] = {
 #define RS_OFF() (LCD_RS_CONTROL_PORT &= (~(1 << LCD_RS_PIN)))
 #define RW_OFF() (LCD_RW_CONTROL_PORT &= (~(1 << LCD_RW_PIN)))
 
+// 4-bit data bus. The shifts are resolved at compile time. Data pins are kept
+// low between transfers, so writing the PIN register (which toggles PORT bits)
+// sets and clears a nibble with one instruction and leaves other pins alone.
+#define LCD_DATA_MASK (0x0F << LCD_DATA_START_PIN)
+#if LCD_DATA_START_PIN <= 4
+	#define LCD_HIGH_NIBBLE(d) (((d) & 0xF0) >> (4 - LCD_DATA_START_PIN))
+#else
+	#define LCD_HIGH_NIBBLE(d) (((d) & 0xF0) << (LCD_DATA_START_PIN - 4))
+#endif
+#define LCD_LOW_NIBBLE(d) (((d) & 0x0F) << LCD_DATA_START_PIN)
+
 #define LCDWriteStringXY(x, y, msg){\
 	 LCDGotoXY(x, y);\
 	 LCDWriteString(msg);\
 }
 
+#define LCDWriteStringXY_P(x, y, msg){\
+	 LCDGotoXY(x, y);\
+	 LCDWriteString_P(msg);\
+}
+
 #define LCDWriteIntXY(x, y, nr, nrOfDigits){\
 	 LCDGotoXY(x, y);\
 	 LCDWriteInt(nr, nrOfDigits);\
 }
 
+#define LCDFrameWriteStringXY(x, y, msg){\
+	 LCDFrameGotoXY(x, y);\
+	 LCDFrameWriteString(msg);\
+}
+
+#define LCDFrameWriteStringXY_P(x, y, msg){\
+	 LCDFrameGotoXY(x, y);\
+	 LCDFrameWriteString_P(msg);\
+}
+
+#define LCDFrameWriteIntXY(x, y, nr, nrOfDigits){\
+	 LCDFrameGotoXY(x, y);\
+	 LCDFrameWriteInt(nr, nrOfDigits);\
+}
+
 
 
 
@@ -261,10 +513,56 @@ static const uint8_t LCD_custom_chars[] = {
 uint8_t cursorType = 0b00001100; // Display on, cursor off by default
 #endif
 
+#ifdef LCD_FRAMEBUFFER
+#define LCD_FRAME_SIZE (LCD_NR_OF_CHARACTERS * LCD_NR_OF_ROWS)
+char LCD_frame[LCD_FRAME_SIZE];  // What the application wants on screen
+char LCD_shadow[LCD_FRAME_SIZE]; // What is currently in DDRAM
+uint8_t LCD_frame_pos = 0;
+#endif
+
+#ifdef LCD_PAGES
+uint8_t LCD_page = 0; // Page on screen
+#endif
+
+#ifdef CUSTOM_CHARS
+const uint8_t *LCD_glyph[8];	// Glyph in each CGRAM slot, 0 if free
+uint8_t LCD_glyph_order[8];		// Slots, least recently used first
+#endif
+
+#ifdef LCD_ASYNC
+#define LCD_QUEUE_MASK (LCD_QUEUE_SIZE - 1)
+// Clear display and return home take up to 1.52 ms
+#define LCD_QUEUE_SLOW_TICKS (1600 / LCD_QUEUE_TICK_US + 1)
+// Power on wait and the 4.1 ms after the first reset nibble, in ticks
+#define LCD_POWER_ON_TICKS ((LCD_POWER_ON_MS * 1000UL + LCD_QUEUE_TICK_US - 1) / LCD_QUEUE_TICK_US)
+#define LCD_RESET_TICKS (4100 / LCD_QUEUE_TICK_US + 1)
+#if LCD_POWER_ON_TICKS > 255
+	#error "LCD_POWER_ON_MS too long for LCD_QUEUE_TICK_US"
+#endif
+#ifndef LCD_QUEUE_WAIT_HOOK
+#define LCD_QUEUE_WAIT_HOOK()
+#endif
+uint8_t LCD_queue_byte[LCD_QUEUE_SIZE];
+uint8_t LCD_queue_isdata[LCD_QUEUE_SIZE];
+volatile uint8_t LCD_queue_head = 0; // Written by the application
+volatile uint8_t LCD_queue_tail = 0; // Written by LCDQueueTick
+volatile uint8_t LCD_queue_hold = 0;
+uint8_t LCD_queue_on = 0; // Set by LCDSetup
+#endif
+
+// 4-bit reset by instruction (HD44780 datasheet, figure 24). The busy flag
+// can only be read after the last one, which selects the 4-bit interface.
+#ifdef BIT_MODE_4
+static const uint8_t LCD_reset_nibbles[] PROGMEM = {0b0011, 0b0011, 0b0011, 0b0010};
+#define LCD_RESET_STEPS 4
+#else
+#define LCD_RESET_STEPS 0
+#endif
+#ifdef LCD_ASYNC
+uint8_t LCD_reset_step = LCD_RESET_STEPS; // Next nibble LCDQueueTick sends
+#endif
+
 void LCDSetup(uint8_t cursorStyle){
-	// After power on wait for LCD to initialize. On 3.3v LCD clock will be slower so add more delay
-	_delay_ms(100);
-	
 	// Save cursor style - used by LCDBacklightPWM function
 	#ifdef LCD_BACKLIGHT
 	cursorType = cursorStyle;
@@ -279,80 +577,44 @@ void LCDSetup(uint8_t cursorStyle){
 	E_OFF();
 	RW_OFF();
 	RS_OFF();
+	HAL_LCD_WIRING(LCD_DATA_START_PIN, LCD_RS_PIN, LCD_RW_PIN, LCD_E_PIN);
+	
+	#ifdef LCD_ASYNC
+	// LCDQueueTick waits for the power on time and sends the reset nibbles,
+	// then everything queued from here on. LCDSetup returns at once.
+	LCD_queue_hold = LCD_POWER_ON_TICKS;
+	LCD_reset_step = 0;
+	LCD_queue_on = 1;
+	#else
+	_delay_ms(LCD_POWER_ON_MS);
+	#ifdef BIT_MODE_4
+	for(uint8_t i = 0; i < LCD_RESET_STEPS; i++){
+		LCDWriteNibble(pgm_read_byte(&LCD_reset_nibbles[i]));
+		if(i == 0) _delay_us(4100);
+		else _delay_us(100);
+	}
+	#endif
+	#endif
 	
 	#ifdef BIT_MODE_8
 		LCDCmd(0b00001100 | cursorStyle); // Turn on display, set cursor type
 		LCDCmd(0x38); // 8 bit mode. Function Set: 8-bit, 2 Line, 5x7 Dots
 	#elif defined BIT_MODE_4
-		// LCD reset instructions according to datasheet's flowchart
-		LCD_DATA_PORT |= 0b00000011 << LCD_DATA_START_PIN;
-		FlashEnable();
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN); // Clear pins
-		_delay_ms(10);
-	
-		LCD_DATA_PORT |= 0b00000011 << LCD_DATA_START_PIN;
-		FlashEnable();
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN);
-		_delay_ms(1);
-		
-		LCD_DATA_PORT |= 0b00000011 << LCD_DATA_START_PIN;
-		FlashEnable();
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN);
-		_delay_ms(1);
-		// End reset
-		
-		LCD_DATA_PORT |= 0b00000010 << LCD_DATA_START_PIN; // Set 4 bit mode
-		FlashEnable();
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN);
-		_delay_ms(1);
-		
 		// 4 bit mode. Function Set: 4-bit, 2 Line, 5x7 Dots. Lines are number of memory lines
 		// not rows on LCD. There are LCDs with 1 line/row that have 2 memory lines and other
 		// LCDs with 1 row with 1 memory line. Please read this article for a better understanding
 		// http://web.alfredstate.edu/weimandn/lcd/lcd_addressing/lcd_addressing_index.html
-		LCD_DATA_PORT |= (0b00000010 | 0b00000000) << LCD_DATA_START_PIN;
-		FlashEnable();
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN);
-		_delay_ms(1);
-		
-		LCD_DATA_PORT |= 0b00001000 << LCD_DATA_START_PIN; // Display off
-		FlashEnable();
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN);
-		_delay_ms(1);
-		
-		LCD_DATA_PORT |= 0b00000001 << LCD_DATA_START_PIN; // Clear Display
-		FlashEnable();
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN);
-		_delay_ms(5);
-		
-		LCD_DATA_PORT |= 0b00000110 << LCD_DATA_START_PIN; // Entry Mode Set
-		FlashEnable();
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN);
-		_delay_ms(1);
-		
-		LCD_DATA_PORT |= 0b00001100 << LCD_DATA_START_PIN; // Turn on display
-		_delay_ms(1);
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN);
-		FlashEnable();
-		// End of intitalization
-	
-		LCD_DATA_PORT |= ((0b00000010) << LCD_DATA_START_PIN);
-		FlashEnable();
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN);
-		_delay_ms(10); // busy flag is not available yet
+		LCDCmd(0x28);
+		LCDCmd(LCD_DISPLAY_OFF);
+		LCDCmd(0b00000110); // Entry mode: increment, no display shift
 		LCDCmd(LCD_DISPLAY_ON | cursorStyle); // Turn on display, set cursor type
-		//LCDCmd(0x28); // 4 bit mode. Function Set: 4-bit, 2 Line, 5x7 Dots
 	#endif
 
 	#ifdef CUSTOM_CHARS
-	// Upload custom characters to LCD's volatile memory
-	uint8_t i, location, pos;
-	for(location=0; location < 8; location++){
-		pos = location * 8;
-		LCDCmd(0b01000000 + pos); // Set location in CGRAM where to write custom char
-		for(i=pos; i < pos+8; i++){
-			LCDData(LCD_custom_chars[i]);
-		}
+	// CGRAM content is undefined after power on, glyphs are uploaded when used
+	for(uint8_t i = 0; i < 8; i++){
+		LCD_glyph[i] = 0;
+		LCD_glyph_order[i] = i;
 	}
 	#endif
 	
@@ -362,13 +624,28 @@ void LCDSetup(uint8_t cursorStyle){
 	
 	LCDClear();
 	LCDHome();
+	
+	#ifdef LCD_FRAMEBUFFER
+	// DDRAM is now all spaces
+	LCDFrameClear();
+	for(uint8_t i = 0; i < LCD_FRAME_SIZE; i++) LCD_shadow[i] = ' ';
+	#endif
 }
 
 void LCDWriteString(const char *msg){
+	LCDWriteStringFrom(msg, 0);
+}
+
+void LCDWriteString_P(const char *msg){
+	LCDWriteStringFrom(msg, 1);
+}
+
+// Characters are read from RAM, or from flash if "progmem" is set
+void LCDWriteStringFrom(const char *msg, uint8_t progmem){
 	uint8_t pos=1;
 	uint8_t line=1;
 	
-	while(*msg > 0){
+	while(LCD_STRING_CHAR(msg, progmem) > 0){
 		#ifdef LCD_WRAP
 			if(pos > LCD_NR_OF_CHARACTERS){
 				if(LCD_NR_OF_ROWS > 1){
@@ -383,7 +660,7 @@ void LCDWriteString(const char *msg){
 						line = 4;
 					}
 					
-					if(line > 1 && *msg == 0x20) msg++; // remove space if it is at the beginning of the line
+					if(line > 1 && LCD_STRING_CHAR(msg, progmem) == 0x20) msg++; // remove space if it is at the beginning of the line
 				}
 				
 				pos = 1;
@@ -392,21 +669,22 @@ void LCDWriteString(const char *msg){
 		
 		// Custom Char Support
 		#ifdef CUSTOM_CHARS
-			if(*msg == '%'){
+			if(LCD_STRING_CHAR(msg, progmem) == '%'){
 				msg++;
-				int8_t c = *msg - '0';
+				int8_t c = LCD_STRING_CHAR(msg, progmem) - '0';
 
 				if(c >= 0 && c < 8){
-					LCDData(c);
+					LCDData(LCDCustomChar(c));
 				}else{
 					LCDData('%');
-					LCDData(*msg);
+					if(LCD_STRING_CHAR(msg, progmem) == 0) break; // "%" at the end
+					LCDData(LCD_STRING_CHAR(msg, progmem));
 				}
 			}else{
-				LCDData(*msg);
+				LCDData(LCD_STRING_CHAR(msg, progmem));
 			}
 		#else
-			LCDData(*msg);
+			LCDData(LCD_STRING_CHAR(msg, progmem));
 		#endif
 			
 		msg++;
@@ -420,9 +698,9 @@ void LCDWriteBigSeparator(){
 	// Calculate new cursor position based on current position
 	LCDGotoXY(cursorPosition, 1);
 		
-	LCDData(0b10100101); // big dot
+	LCDData(LCD_BIG_DOT);
 	LCDGotoXY(cursorPosition-1, 2);
-	LCDData(0b10100101); // big dot
+	LCDData(LCD_BIG_DOT);
 }
 
 void LCDWriteIntBig(int16_t number, int8_t nrOfDigits){
@@ -465,68 +743,10 @@ void LCDWriteIntBig(int16_t number, int8_t nrOfDigits){
 		LCDGotoXY(cursorPosition, 1);
 		new_pos = cursorPosition;
 		line = 2;
-	
-		switch(buffer[length-1]){
-			case 0:
-				LCDData(1);
-				LCDGotoXY(new_pos, line);
-				LCDData(5);
-			break;
-			
-			case 1:
-				LCDData(0);
-				LCDGotoXY(new_pos, line);
-				LCDData(0);
-			break;
-			
-			case 2:
-				LCDData(7);
-				LCDGotoXY(new_pos, line);
-				LCDData(2);
-			break;
-			
-			case 3:
-				LCDData(6);
-				LCDGotoXY(new_pos, line);
-				LCDData(3);
-			break;
-			
-			case 4:
-				LCDData(5);
-				LCDGotoXY(new_pos, line);
-				LCDData(0);
-			break;
-			
-			case 5:
-				LCDData(2);
-				LCDGotoXY(new_pos, line);
-				LCDData(3);
-			break;
-			
-			case 6:
-				LCDData(2);
-				LCDGotoXY(new_pos, line);
-				LCDData(5);
-			break;
-			
-			case 7:
-				LCDData(7);
-				LCDGotoXY(new_pos, line);
-				LCDData(0);
-			break;
-			
-			case 8:
-				LCDData(4);
-				LCDGotoXY(new_pos, line);
-				LCDData(5);
-			break;
-			
-			case 9:
-				LCDData(4);
-				LCDGotoXY(new_pos, line);
-				LCDData(3);
-			break;
-		}
+		
+		LCDData(LCDCustomChar(pgm_read_byte(&LCD_big_digits[buffer[length-1]][0])));
+		LCDGotoXY(new_pos, line);
+		LCDData(LCDCustomChar(pgm_read_byte(&LCD_big_digits[buffer[length-1]][1])));
 		
 		length--;
 	}
@@ -587,100 +807,10 @@ void LCDWriteIntBig3Chars(int16_t number, int8_t nrOfDigits){
 		LCDGotoXY(cursorPosition, 1);
 		new_pos = cursorPosition;
 		line = 2;
-	
-		switch(buffer[length-1]){
-			case 0:
-				LCDData(0);
-				LCDData(1);
-				LCDData(2);
-				LCDGotoXY(new_pos, line);
-				LCDData(3);
-				LCDData(4);
-				LCDData(5);
-			break;
-			
-			case 1:
-				LCDData(1);
-				LCDData(2);
-				LCDGotoXY(new_pos, line);
-				LCDData(4);
-				LCDData(7);
-				LCDData(4);
-			break;
-			
-			case 2:
-				LCDData(6);
-				LCDData(6);
-				LCDData(2);
-				LCDGotoXY(new_pos, line);
-				LCDData(3);
-				LCDData(4);
-				LCDData(4);
-			break;
-			
-			case 3:
-				LCDData(6);
-				LCDData(6);
-				LCDData(2);
-				LCDGotoXY(new_pos, line);
-				LCDData(4);
-				LCDData(4);
-				LCDData(5);
-			break;
-			
-			case 4:
-				LCDData(3);
-				LCDData(4);
-				LCDData(7);
-				LCDGotoXY(new_pos+2, line);
-				LCDData(7);
-			break;
-			
-			case 5:
-				LCDData(3);
-				LCDData(6);
-				LCDData(6);
-				LCDGotoXY(new_pos, line);
-				LCDData(4);
-				LCDData(4);
-				LCDData(5);
-			break;
-			
-			case 6:
-				LCDData(0);
-				LCDData(6);
-				LCDData(6);
-				LCDGotoXY(new_pos, line);
-				LCDData(3);
-				LCDData(4);
-				LCDData(5);
-			break;
-			
-			case 7:
-				LCDData(1);
-				LCDData(1);
-				LCDData(2);
-				LCDGotoXY(new_pos+2, line);
-				LCDData(7);
-			break;
-			
-			case 8:
-				LCDData(0);
-				LCDData(6);
-				LCDData(2);
-				LCDGotoXY(new_pos, line);
-				LCDData(3);
-				LCDData(4);
-				LCDData(5);
-			break;
-			
-			case 9:
-				LCDData(0);
-				LCDData(6);
-				LCDData(2);
-				LCDGotoXY(new_pos+2, line);
-				LCDData(7);
-			break;
+		
+		for(i=0; i<6; i++){
+			if(i == 3) LCDGotoXY(new_pos, line);
+			LCDData(LCDCustomChar(pgm_read_byte(&LCD_big3_digits[buffer[length-1]][i])));
 		}
 		
 		LCDData(' '); // Insert a space between digits to distinguish them better
@@ -691,9 +821,34 @@ void LCDWriteIntBig3Chars(int16_t number, int8_t nrOfDigits){
 
 void LCDWriteInt(int16_t number, int8_t nrOfDigits){
 	char string[7] = {0};
+	
+	LCDIntToString(number, nrOfDigits, string);
+	LCDWriteString(string);
+}
+
+// "string" must hold at least 7 characters and be zero filled
+void LCDIntToString(int16_t number, int8_t nrOfDigits, char *string){
 	uint8_t isNegative = 0, length = 0, divide;
 	int16_t copyOfNumber = number;
 	
+	// Fast path without division for small positive numbers
+	if(number >= 0 && number < 256){
+		uint16_t bcd = LCDBinToBCD(number);
+		
+		if(bcd > 0x99) length = 3;
+		else if(bcd > 0x09) length = 2;
+		else if(bcd > 0) length = 1;
+		
+		nrOfDigits -= length;
+		if(nrOfDigits < 0) nrOfDigits = 0;
+		
+		for(divide = length + nrOfDigits; divide > 0; divide--){
+			string[divide-1] = (bcd & 0x0F) + '0';
+			bcd >>= 4;
+		}
+		return;
+	}
+	
 	// Find number of digits
 	while(copyOfNumber != 0){ 
 		length++;
@@ -717,12 +872,29 @@ void LCDWriteInt(int16_t number, int8_t nrOfDigits){
 	}
 	
 	if(isNegative) string[0] = '-';
+}
+
+// Double dabble: 8 bit binary to 3 packed BCD digits
+uint16_t LCDBinToBCD(uint8_t bin){
+	uint16_t bcd = 0;
+	uint8_t i;
 	
-	LCDWriteString(string);
+	for(i = 0; i < 8; i++){
+		if((bcd & 0x000F) >= 0x0005) bcd += 0x0003;
+		if((bcd & 0x00F0) >= 0x0050) bcd += 0x0030;
+		bcd = (bcd << 1) | (bin >> 7);
+		bin <<= 1;
+	}
+	
+	return bcd;
+}
+
+void LCDWriteBCD(uint8_t bcd){
+	LCDData((bcd >> 4) + '0');
+	LCDData((bcd & 0x0F) + '0');
 }
 
 void LCDGotoXY(uint8_t x, uint8_t y){
-	LCDBusyLoop();
 	if(x == 0 || x == 255) x = 1; // User can use 0 or 1 as starting character position
 	cursorPosition = x;
 	cursorLine = y;
@@ -784,19 +956,45 @@ void LCDBacklightPWM(uint8_t brightness){
 #endif
 
 void LCDByte(uint8_t data, uint8_t isdata){
-	LCDBusyLoop();
-	
 	if(isdata == 0){
-		RS_OFF(); // Send command - RS to 0
-		if(data == 0b10000000 || data == 0b00000001){
+		if(data == 0b10000000 || data == 0b00000001 || data == LCD_RETURN_HOME){
 			cursorPosition = 1;
 			cursorLine = 1;
 		}
+		#ifdef LCD_PAGES
+		if(data == 0b00000001 || data == LCD_RETURN_HOME) LCD_page = 0; // Shift is reset
+		#endif
 	}else{
-		RS_ON(); // Send data - RS to 1
 		cursorPosition++;
 	}
 	
+	#ifdef LCD_ASYNC
+	if(LCD_queue_on){
+		uint8_t head = LCD_queue_head;
+		uint8_t next = (head + 1) & LCD_QUEUE_MASK;
+		
+		// Queue full, wait for LCDQueueTick
+		while(next == LCD_queue_tail) LCDQueueWaitTick();
+		
+		LCD_queue_byte[head] = data;
+		LCD_queue_isdata[head] = isdata;
+		LCD_queue_head = next; // Publish after the slot is filled
+		return;
+	}
+	#endif
+	
+	LCDBusyLoop();
+	LCDWrite(data, isdata);
+}
+
+// Put a byte on the bus without checking the busy flag
+void LCDWrite(uint8_t data, uint8_t isdata){
+	if(isdata == 0){
+		RS_OFF(); // Send command - RS to 0
+	}else{
+		RS_ON(); // Send data - RS to 1
+	}
+	
 	RW_OFF(); // RW to 0 - write mode
 	
 	#ifdef BIT_MODE_8
@@ -804,20 +1002,13 @@ void LCDByte(uint8_t data, uint8_t isdata){
 		FlashEnable();
 		LCD_DATA_PORT = 0x00;
 	#elif defined BIT_MODE_4
-		unsigned char temp; // If signed, after shift MSB will be replaced with 1 instead of 0 and we don't want that
-		uint8_t shift = PORT_SIZE - (LCD_DATA_START_PIN + 4);
-	
-		// Send high nibble
-		temp = (data & 0xF0); // Mask the lower nibble
-		LCD_DATA_PORT |= temp >> shift; // Put data on data port
+		uint8_t high = LCD_HIGH_NIBBLE(data), low = LCD_LOW_NIBBLE(data);
+		
+		LCD_DATA_PIN = high; // Send high nibble (pins were low)
 		FlashEnable();
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN);
-	
-		// Send low nibble
-		temp = ((data << 4) & 0xF0); // Shift 4-bit and mask
-		LCD_DATA_PORT |= temp >> shift;
+		LCD_DATA_PIN = high ^ low; // Send low nibble
 		FlashEnable();
-		LCD_DATA_PORT &= ~(0x0F << LCD_DATA_START_PIN); // Clear data port
+		LCD_DATA_PIN = low; // Clear data pins
 	#endif
 }
 
@@ -842,17 +1033,17 @@ void LCDBusyLoop(){
 		do{
 			// Read high nibble
 			E_ON();
-			_delay_us(1); // Implement 'Delay data time' (160 nS) and 'Enable pulse width' (230 nS)
+			LCD_DELAY_US(1); // Implement 'Delay data time' (160 nS) and 'Enable pulse width' (230 nS)
 			high_nibble = LCD_DATA_PIN >> LCD_DATA_START_PIN;
 			high_nibble = high_nibble << 4;
 			E_OFF();
-			_delay_us(1); // Implement 'Address hold time' (10 nS), 'Data hold time' (10 nS), and 'Enable cycle time' (500 nS )
+			LCD_DELAY_US(1); // Implement 'Address hold time' (10 nS), 'Data hold time' (10 nS), and 'Enable cycle time' (500 nS )
 			
 			// No need for low nibble
 			E_ON();
-			_delay_us(1);
+			LCD_DELAY_US(1);
 			E_OFF();
-			_delay_us(1);
+			LCD_DELAY_US(1);
 			
 			busy = high_nibble & 0b10000000;
 		}while(busy);
@@ -870,64 +1061,407 @@ void LCDBusyLoop(){
 
 void FlashEnable(){
 	E_ON(); // Enable on
-	_delay_us(50); // Wait
+	#ifdef LCD_ASYNC
+	if(LCD_queue_on){
+		LCD_DELAY_US(1); // 'Enable pulse width' (230 nS), no need to hold an ISR for 50 uS
+		E_OFF();
+		return;
+	}
+	#endif
+	LCD_DELAY_US(50); // Wait
 	E_OFF(); // Execute
 }
 
-/* ----------------------------------- ANIMATIONS */
-#ifdef LCD_ANIMATIONS
-void LCDScrollText(const char *text){
-	uint8_t shift_number=1, i=0, chars_to_display=1;
-	size_t text_size = strlen(text);
-	const char *text_start_pos = text;
+/* ----------------------------------- CUSTOM CHARACTERS */
+#ifdef CUSTOM_CHARS
+uint8_t LCDGlyph(const uint8_t *glyph){
+	LCDGlyphLoad(glyph, 1);
+	return LCDGlyphFind(glyph);
+}
 
-	LCDClear();
-	LCDGotoXY(LCD_NR_OF_CHARACTERS, 1);
+void LCDGlyphLoad(const uint8_t *glyphs, uint8_t count){
+	uint8_t i, slot, missing = 0, used = 0, x, y;
+	const uint8_t *glyph;
+	
+	if(count > 8) count = 8;
 	
-	while(shift_number < text_size + LCD_NR_OF_CHARACTERS){
+	// Glyphs already in CGRAM become the most recently used
+	for(i = 0; i < count; i++){
+		slot = LCDGlyphFind(glyphs + i * 8);
+		if(slot < 8){
+			LCDGlyphTouch(slot);
+			used |= 1 << slot;
+		}else{
+			missing++;
+		}
+	}
+	if(!missing) return;
+	
+	#ifdef LCD_FRAMEBUFFER
+	// Keep the glyphs on screen and the ones the frame will show. After
+	// LCDFrameClear() the frame has none, but until the next LCDFlush() the
+	// screen still does and a new bitmap would repaint those cells.
+	for(i = 0; i < LCD_FRAME_SIZE; i++){
+		if((uint8_t)LCD_frame[i] < 8) used |= 1 << LCD_frame[i];
+		if((uint8_t)LCD_shadow[i] < 8) used |= 1 << LCD_shadow[i];
+	}
+	#endif
+	
+	// Give each missing glyph the least recently used slot that is not in use
+	missing = 0;
+	for(i = 0; i < count; i++){
+		glyph = glyphs + i * 8;
+		if(LCDGlyphFind(glyph) < 8) continue; // Twice in the list
 		
-		while(i < chars_to_display){
-			LCDData(*text);
-			i++;
-			text++;
+		slot = LCD_glyph_order[0]; // All in use, take the oldest anyway
+		for(x = 0; x < 8; x++){
+			if(!(used & (1 << LCD_glyph_order[x]))){
+				slot = LCD_glyph_order[x];
+				break;
+			}
 		}
 		
-		_delay_ms(LCD_SCROLL_SPEED); // 200 - 300 is a good choise
-		LCDClear();
+		LCD_glyph[slot] = glyph;
+		LCDGlyphTouch(slot);
+		used |= 1 << slot;
+		missing |= 1 << slot;
+	}
+	
+	// Upload, the CGRAM address auto increments across neighbouring slots
+	x = cursorPosition;
+	y = cursorLine;
+	for(slot = 0; slot < 8; slot++){
+		if(!(missing & (1 << slot))) continue;
+		if(slot == 0 || !(missing & (1 << (slot - 1)))){
+			LCDCmd(0b01000000 | (slot << 3)); // Set CGRAM address
+		}
+		for(i = 0; i < 8; i++){
+			LCDData(pgm_read_byte(&LCD_glyph[slot][i]));
+		}
+	}
+	LCDGotoXY(x, y); // Data goes to DDRAM again
+}
+
+uint8_t LCDCustomChar(uint8_t n){
+	if(n >= 8) return n;
+	return LCDGlyph(&LCD_custom_chars[n * 8]);
+}
+
+// Slot holding "glyph", 8 if none
+uint8_t LCDGlyphFind(const uint8_t *glyph){
+	uint8_t slot;
+	
+	for(slot = 0; slot < 8; slot++){
+		if(LCD_glyph[slot] == glyph) break;
+	}
+	return slot;
+}
+
+// Move "slot" to the most recently used end of the order
+void LCDGlyphTouch(uint8_t slot){
+	uint8_t i = 0;
+	
+	while(LCD_glyph_order[i] != slot) i++;
+	for(; i < 7; i++) LCD_glyph_order[i] = LCD_glyph_order[i + 1];
+	LCD_glyph_order[7] = slot;
+}
+#endif
+
+#ifdef BIT_MODE_4
+// Half a command, for the reset sequence
+void LCDWriteNibble(uint8_t nibble){
+	RS_OFF();
+	RW_OFF();
+	LCD_DATA_PIN = LCD_LOW_NIBBLE(nibble); // Pins were low
+	FlashEnable();
+	LCD_DATA_PIN = LCD_LOW_NIBBLE(nibble);
+}
+#endif
+
+/* ----------------------------------- ASYNCHRONOUS TRANSPORT */
+#ifdef LCD_ASYNC
+void LCDQueueTick(void){
+	uint8_t tail = LCD_queue_tail;
+	
+	if(LCD_queue_hold){ // Previous instruction is still executing
+		LCD_queue_hold--;
+		return;
+	}
+	#ifdef BIT_MODE_4
+	if(LCD_reset_step < LCD_RESET_STEPS){ // LCDSetup
+		LCDWriteNibble(pgm_read_byte(&LCD_reset_nibbles[LCD_reset_step]));
+		if(LCD_reset_step == 0) LCD_queue_hold = LCD_RESET_TICKS - 1;
+		LCD_reset_step++;
+		return;
+	}
+	#endif
+	if(tail == LCD_queue_head) return;
+	
+	LCDWrite(LCD_queue_byte[tail], LCD_queue_isdata[tail]);
+	if(LCD_queue_isdata[tail] == 0 && LCD_queue_byte[tail] < 0b00000100){
+		LCD_queue_hold = LCD_QUEUE_SLOW_TICKS - 1; // Clear display or return home
+	}
+	
+	LCD_queue_tail = (tail + 1) & LCD_QUEUE_MASK;
+}
+
+uint8_t LCDQueuePending(void){
+	return LCD_queue_head != LCD_queue_tail || LCD_queue_hold || LCD_reset_step < LCD_RESET_STEPS;
+}
+
+void LCDQueueWait(void){
+	while(LCDQueuePending()) LCDQueueWaitTick();
+}
+
+// Wait for one tick. With interrupts off (in an ISR or a cli() section) the
+// timer cannot call LCDQueueTick(), so run it here after a tick period.
+void LCDQueueWaitTick(void){
+	if(SREG & (1 << SREG_I)){
+		LCD_QUEUE_WAIT_HOOK();
+		HAL_WAIT();
+	}else{
+		LCD_DELAY_US(LCD_QUEUE_TICK_US);
+		LCDQueueTick();
+	}
+}
+#endif
+
+/* ----------------------------------- FRAMEBUFFER */
+#ifdef LCD_FRAMEBUFFER
+void LCDFrameGotoXY(uint8_t x, uint8_t y){
+	if(x == 0 || x == 255) x = 1; // Same conventions as LCDGotoXY
+	if(y == 0 || y == 255) y = 1;
+	if(x > LCD_NR_OF_CHARACTERS) x = LCD_NR_OF_CHARACTERS;
+	if(y > LCD_NR_OF_ROWS) y = LCD_NR_OF_ROWS;
+	
+	LCD_frame_pos = (y - 1) * LCD_NR_OF_CHARACTERS + (x - 1);
+}
+
+void LCDFrameWriteString(const char *msg){
+	LCDFrameWriteStringFrom(msg, 0);
+}
+
+void LCDFrameWriteString_P(const char *msg){
+	LCDFrameWriteStringFrom(msg, 1);
+}
+
+void LCDFrameWriteStringFrom(const char *msg, uint8_t progmem){
+	#ifndef LCD_WRAP
+	// Clip at the end of the current line
+	uint8_t line_end = (LCD_frame_pos / LCD_NR_OF_CHARACTERS + 1) * LCD_NR_OF_CHARACTERS;
+	#else
+	uint8_t line_end = LCD_FRAME_SIZE;
+	#endif
+	
+	while(LCD_STRING_CHAR(msg, progmem) > 0 && LCD_frame_pos < line_end){
+		LCD_frame[LCD_frame_pos++] = LCD_STRING_CHAR(msg, progmem);
+		msg++;
+	}
+}
+
+// A format string in flash: "%b" takes a packed BCD byte, "%d" an int16_t
+// (no padding) and "%%" is a percent sign. Clipped like LCDFrameWriteString.
+void LCDFrameWriteFormat_P(const char *format, ...){
+	va_list args;
+	char c, string[7];
+	uint8_t i;
+	#ifndef LCD_WRAP
+	uint8_t line_end = (LCD_frame_pos / LCD_NR_OF_CHARACTERS + 1) * LCD_NR_OF_CHARACTERS;
+	#else
+	uint8_t line_end = LCD_FRAME_SIZE;
+	#endif
+	
+	va_start(args, format);
+	while((c = pgm_read_byte(format++)) > 0 && LCD_frame_pos < line_end){
+		if(c != '%'){
+			LCD_frame[LCD_frame_pos++] = c;
+			continue;
+		}
 		
-		if(shift_number < LCD_NR_OF_CHARACTERS && shift_number < text_size){
-			LCDGotoXY(LCD_NR_OF_CHARACTERS - shift_number, 1);
-			text = text_start_pos;
-			chars_to_display++;
+		for(i = 0; i < 7; i++) string[i] = 0;
+		c = pgm_read_byte(format++);
+		if(c == 'b'){
+			uint8_t bcd = va_arg(args, int);
+			string[0] = (bcd >> 4) + '0';
+			string[1] = (bcd & 0x0F) + '0';
+		}else if(c == 'd'){
+			LCDIntToString(va_arg(args, int), 1, string);
+		}else if(c > 0){
+			string[0] = c;
 		}else{
-			if(text_size > LCD_NR_OF_CHARACTERS){
-				if(shift_number + 1 > text_size)
-					chars_to_display--;
-				else
-					chars_to_display = LCD_NR_OF_CHARACTERS;
-				
-				text = text_start_pos + (shift_number - (LCD_NR_OF_CHARACTERS - 1));
-				LCDGotoXY(1, 1);
-			}else{
-				if(shift_number + 1 > LCD_NR_OF_CHARACTERS){
-					chars_to_display--;
-					text = text_start_pos + (shift_number - LCD_NR_OF_CHARACTERS) + 1;
-					LCDGotoXY(1, 1);
-				}else{
-					text = text_start_pos;
-					chars_to_display = text_size;
-					LCDGotoXY(LCD_NR_OF_CHARACTERS - shift_number, 1);
-				}
+			break; // "%" at the end
+		}
+		
+		for(i = 0; string[i] > 0 && LCD_frame_pos < line_end; i++){
+			LCD_frame[LCD_frame_pos++] = string[i];
+		}
+	}
+	va_end(args);
+}
+
+void LCDFrameWriteInt(int16_t number, int8_t nrOfDigits){
+	char string[7] = {0};
+	
+	LCDIntToString(number, nrOfDigits, string);
+	LCDFrameWriteString(string);
+}
+
+void LCDFrameWriteBCD(uint8_t bcd){
+	char string[3] = {(char)((bcd >> 4) + '0'), (char)((bcd & 0x0F) + '0'), 0};
+	
+	LCDFrameWriteString(string);
+}
+
+void LCDFrameClear(void){
+	uint8_t i;
+	
+	for(i = 0; i < LCD_FRAME_SIZE; i++) LCD_frame[i] = ' ';
+	LCD_frame_pos = 0;
+}
+
+#ifdef LCD_BIG_FONT
+// Top row at the frame position, bottom row below it. Clipped at the edges.
+void LCDFrameWriteBigDigit(uint8_t digit){
+	uint8_t i, pos = LCD_frame_pos;
+	
+	if(digit > 9) return;
+	if(pos % LCD_NR_OF_CHARACTERS + LCD_BIG_WIDTH + LCD_BIG_GAP > LCD_NR_OF_CHARACTERS) return;
+	if(pos + LCD_NR_OF_CHARACTERS >= LCD_FRAME_SIZE) return; // No row below
+	
+	for(i = 0; i < LCD_BIG_WIDTH; i++){
+		LCD_frame[pos + i] = LCDCustomChar(pgm_read_byte(&LCD_BIG_FONT[digit][i]));
+		LCD_frame[pos + LCD_NR_OF_CHARACTERS + i] = LCDCustomChar(pgm_read_byte(&LCD_BIG_FONT[digit][LCD_BIG_WIDTH + i]));
+	}
+	for(; i < LCD_BIG_WIDTH + LCD_BIG_GAP; i++){
+		LCD_frame[pos + i] = ' ';
+		LCD_frame[pos + LCD_NR_OF_CHARACTERS + i] = ' ';
+	}
+	LCD_frame_pos = pos + i;
+}
+
+void LCDFrameWriteBigBCD(uint8_t bcd){
+	LCDFrameWriteBigDigit(bcd >> 4);
+	LCDFrameWriteBigDigit(bcd & 0x0F);
+}
+
+// One column, a dot on each row
+void LCDFrameWriteBigSeparator(void){
+	uint8_t pos = LCD_frame_pos;
+	
+	if(pos + LCD_NR_OF_CHARACTERS >= LCD_FRAME_SIZE) return;
+	LCD_frame[pos] = LCD_BIG_DOT;
+	LCD_frame[pos + LCD_NR_OF_CHARACTERS] = LCD_BIG_DOT;
+	LCD_frame_pos = pos + 1;
+}
+#endif
+
+void LCDFlush(void){
+	uint8_t x, y, i = 0, inPlace;
+	
+	for(y = 1; y <= LCD_NR_OF_ROWS; y++){
+		inPlace = 0; // DDRAM lines are not contiguous, move the cursor on every line
+		
+		for(x = 1; x <= LCD_NR_OF_CHARACTERS; x++, i++){
+			if(LCD_frame[i] == LCD_shadow[i]){
+				inPlace = 0;
+				continue;
 			}
+			
+			if(!inPlace){
+				#ifdef LCD_PAGES
+				LCDPageGotoXY(LCD_page, x, y); // The page on screen
+				#else
+				LCDGotoXY(x, y);
+				#endif
+				inPlace = 1;
+			}
+			
+			LCDData(LCD_frame[i]); // DDRAM address auto increments
+			LCD_shadow[i] = LCD_frame[i];
+		}
+	}
+}
+#endif
+
+/* ----------------------------------- ANIMATIONS */
+#ifdef LCD_ANIMATIONS
+void LCDScrollText(const char *text){
+	LCDScrollTextFrom(text, 0);
+}
+
+void LCDScrollText_P(const char *text){
+	LCDScrollTextFrom(text, 1);
+}
+
+void LCDScrollTextFrom(const char *text, uint8_t progmem){
+	size_t shift, next;
+	uint8_t column;
+	size_t text_size = progmem ? strlen_P(text) : strlen(text);
+	
+	// The text is written once, right of the visible area, and the display
+	// shift moves the view over it. Line 2 moves too and stays blank.
+	LCDClear();
+	LCDGotoXY(LCD_NR_OF_CHARACTERS + 1, 1);
+	for(next = 0; next < text_size && next < LCD_DDRAM_LINE - LCD_NR_OF_CHARACTERS; next++){
+		LCDData(LCD_STRING_CHAR(text + next, progmem));
+	}
+	
+	for(shift = 1; shift <= text_size + LCD_NR_OF_CHARACTERS; shift++){
+		LCDCmd(LCD_SHIFT_LEFT);
+		
+		// The column that just left the view on the left comes back on the
+		// right after the rest of the line: the next character, or a space
+		// once the text is written
+		if(text_size > LCD_DDRAM_LINE - LCD_NR_OF_CHARACTERS){
+			column = (shift - 1) % LCD_DDRAM_LINE;
+			LCDGotoXY(column + 1, 1);
+			LCDData(next < text_size ? LCD_STRING_CHAR(text + next, progmem) : ' ');
+			next++;
 		}
 		
-		i = 0;
-		shift_number++;
+		_delay_ms(LCD_SCROLL_SPEED); // 200 - 300 is a good choise
 	}
 	
-	LCDHome();
+	LCDClear(); // Blank DDRAM and no shift, as before the scroll
+}
+#endif
+
+/* ----------------------------------- PAGES */
+#ifdef LCD_PAGES
+void LCDPageGotoXY(uint8_t page, uint8_t x, uint8_t y){
+	if(x == 0 || x == 255) x = 1;
+	LCDGotoXY(x + (page ? LCD_PAGE_OFFSET : 0), y);
+}
+
+// Page 0 is one command, page 1 a display shift per column (37 us each)
+void LCDPageShow(uint8_t page){
+	uint8_t i;
+	
+	if(page == LCD_page) return;
+	if(page == 0){
+		LCDCmd(LCD_RETURN_HOME);
+	}else{
+		for(i = 0; i < LCD_PAGE_OFFSET; i++) LCDCmd(LCD_SHIFT_LEFT);
+	}
+	LCD_page = page;
+}
+
+#ifdef LCD_FRAMEBUFFER
+// Write the whole frame to the hidden page, then show it
+void LCDFlip(void){
+	uint8_t x, y, i = 0, page = LCD_page ^ 1;
+	
+	for(y = 1; y <= LCD_NR_OF_ROWS; y++){
+		LCDPageGotoXY(page, 1, y);
+		for(x = 0; x < LCD_NR_OF_CHARACTERS; x++, i++){
+			LCDData(LCD_frame[i]);
+			LCD_shadow[i] = LCD_frame[i];
+		}
+	}
+	LCDPageShow(page);
 }
 #endif
+#endif
 
 /* ----------------------------------- UTILS */ 
 #ifdef LCD_UTILS
@@ -947,4 +1481,177 @@ void LCDFindCharPositions(void){
 	}
 }
 #endif
+/* ----------------------------------- COMPILE TIME FORMAT */
+#if defined(__cplusplus) && __cplusplus >= 201402L
+// The format string is only read by these constexpr functions, at compile time
+constexpr uint8_t LCDFormatIsDigit(char c){
+	return c >= '0' && c <= '9';
+}
+
+// 0 end, 1 character, 2 "%%", 3 conversion
+constexpr uint8_t LCDFormatKind(const char *f, unsigned i){
+	return f[i] == 0 ? 0 : f[i] != '%' ? 1 : f[i + 1] == '%' ? 2 : 3;
+}
+
+// Index of the conversion letter of the "%" at i
+constexpr unsigned LCDFormatTypeAt(const char *f, unsigned i){
+	for(i++; LCDFormatIsDigit(f[i]); i++);
+	return i;
+}
+
+constexpr char LCDFormatType(const char *f, unsigned i){
+	return f[LCDFormatTypeAt(f, i)];
+}
+
+constexpr uint8_t LCDFormatWidth(const char *f, unsigned i){
+	uint8_t width = 0;
+	
+	for(i++; LCDFormatIsDigit(f[i]); i++) width = width * 10 + (f[i] - '0');
+	return width;
+}
+
+constexpr uint8_t LCDFormatZero(const char *f, unsigned i){
+	return f[i + 1] == '0';
+}
+
+// Longest text the format can produce
+constexpr uint8_t LCDFormatLength(const char *f){
+	uint8_t length = 0, width = 0, most = 0;
+	unsigned i = 0;
+	char type = 0;
+	
+	while(f[i]){
+		if(LCDFormatKind(f, i) != 3){
+			length++;
+			i += LCDFormatKind(f, i);
+			continue;
+		}
+		width = LCDFormatWidth(f, i);
+		type = LCDFormatType(f, i);
+		if(type == 0) break; // "%" at the end, LCDFormatPut rejects it
+		most = type == 'b' ? 2 : type == 'c' ? 1 : type == 'u' ? 5 : 6;
+		length += width > most ? width : most;
+		i = LCDFormatTypeAt(f, i) + 1;
+	}
+	return length;
+}
+
+// Digits of "value", at least "width" characters with the sign
+inline char *LCDFormatNumber(char *p, uint16_t value, uint8_t width, uint8_t zero, char sign){
+	char digits[5];
+	uint8_t n = 0;
+	
+	if(value < 256){
+		uint16_t bcd = LCDBinToBCD(value);
+		do{
+			digits[n++] = (bcd & 0x0F) + '0';
+			bcd >>= 4;
+		}while(bcd);
+	}else{
+		do{
+			digits[n++] = value % 10 + '0';
+			value /= 10;
+		}while(value);
+	}
+	
+	if(sign && zero) *p++ = sign;
+	for(; width > n + (sign != 0); width--) *p++ = zero ? '0' : ' ';
+	if(sign && !zero) *p++ = sign;
+	while(n) *p++ = digits[--n];
+	return p;
+}
+
+template <char TYPE, uint8_t WIDTH, uint8_t ZERO> struct LCDFormatPut{
+	static_assert(TYPE == 'u', "LCDPrintf conversions are %u %d %b %c and %%");
+	static char *put(char *p, uint16_t value){
+		return LCDFormatNumber(p, value, WIDTH, ZERO, 0);
+	}
+};
+
+template <uint8_t WIDTH, uint8_t ZERO> struct LCDFormatPut<'d', WIDTH, ZERO>{
+	static char *put(char *p, int16_t value){
+		if(value < 0) return LCDFormatNumber(p, -(uint16_t)value, WIDTH, ZERO, '-');
+		return LCDFormatNumber(p, value, WIDTH, ZERO, 0);
+	}
+};
+
+template <uint8_t WIDTH, uint8_t ZERO> struct LCDFormatPut<'b', WIDTH, ZERO>{
+	static char *put(char *p, uint8_t bcd){
+		p[0] = (bcd >> 4) + '0';
+		p[1] = (bcd & 0x0F) + '0';
+		return p + 2;
+	}
+};
+
+template <uint8_t WIDTH, uint8_t ZERO> struct LCDFormatPut<'c', WIDTH, ZERO>{
+	static char *put(char *p, char c){
+		*p = c;
+		return p + 1;
+	}
+};
+
+// One step of the format at index I, then the steps after it
+template <class F, unsigned I, uint8_t KIND = LCDFormatKind(F::str(), I)> struct LCDFormatOp;
+
+template <class F, unsigned I> struct LCDFormatOp<F, I, 0>{
+	template <class... A> static char *run(char *p, A...){
+		static_assert(sizeof...(A) == 0, "LCDPrintf has more arguments than conversions");
+		return p;
+	}
+};
+
+template <class F, unsigned I> struct LCDFormatOp<F, I, 1>{
+	template <class... A> static char *run(char *p, A... args){
+		constexpr char c = F::str()[I];
+		*p = c;
+		return LCDFormatOp<F, I + 1>::run(p + 1, args...);
+	}
+};
+
+template <class F, unsigned I> struct LCDFormatOp<F, I, 2>{
+	template <class... A> static char *run(char *p, A... args){
+		*p = '%';
+		return LCDFormatOp<F, I + 2>::run(p + 1, args...);
+	}
+};
+
+template <class F, unsigned I> struct LCDFormatOp<F, I, 3>{
+	template <class T, class... A> static char *run(char *p, T value, A... args){
+		p = LCDFormatPut<LCDFormatType(F::str(), I), LCDFormatWidth(F::str(), I),
+			LCDFormatZero(F::str(), I)>::put(p, value);
+		return LCDFormatOp<F, LCDFormatTypeAt(F::str(), I) + 1>::run(p, args...);
+	}
+	static char *run(char *p){
+		static_assert(sizeof(F) == 0, "LCDPrintf has fewer arguments than conversions");
+		return p;
+	}
+};
+
+// Sent as it is: a "%" in the text is not a custom char code
+template <class F, class... A> void LCDPrintfWith(F, A... args){
+	char text[LCDFormatLength(F::str()) + 1];
+	char *end = LCDFormatOp<F, 0>::run(text, args...);
+	
+	for(char *p = text; p < end; p++) LCDData(*p);
+}
+
+#ifdef LCD_FRAMEBUFFER
+template <class F, class... A> void LCDFramePrintfWith(F, A... args){
+	char text[LCDFormatLength(F::str()) + 1];
+	
+	*LCDFormatOp<F, 0>::run(text, args...) = 0;
+	LCDFrameWriteString(text);
+}
+#endif
+
+// A type that carries the string literal, so templates can read it
+#define LCD_FORMAT(format) [](){ \
+	struct LCDFormat { static constexpr const char *str(){ return format; } }; \
+	return LCDFormat(); \
+}()
+
+#define LCDPrintf(format, ...) LCDPrintfWith(LCD_FORMAT(format), ##__VA_ARGS__)
+#define LCDFramePrintf(format, ...) LCDFramePrintfWith(LCD_FORMAT(format), ##__VA_ARGS__)
+#endif
+
 #endif // OnLCDLib
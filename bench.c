@@ -0,0 +1,191 @@
+/*_______________________________________________________________________________
+bench.c - Cycle counts of the firmware hot paths, run under simavr
+
+"make bench" builds this file twice: with the synchronous LCD driver (bench
+image "sync") and with LCD_ASYNC like feeder.c (image "async"). Timer1 runs at
+clk/1, so a case costs TCNT1 after minus TCNT1 before, less the cost of an
+empty measurement. Each result goes to the simavr console (GPIOR0) as a line
+	bench <image> <case> <cycles>
+and when all are printed the CPU sleeps with interrupts off, which ends the
+simavr run. bench.sh adds flash and stack sizes and compares with
+bench.baseline.
+
+Nothing is attached to the simulated LCD bus, so the busy flag always reads
+ready: the sync numbers are CPU time plus the driver's fixed delays, the
+async numbers are what the caller pays to queue the bytes. ISR entry and exit
+(about 40 cycles) are not part of motor_step or LCDQueueTick.
+
+A case name is the function it measures, optionally followed by "-" and a
+variant; bench.sh looks up the sizes by the part before the "-".
+__________________________________________________________________________________*/
+
+#include "hal.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <string.h>
+#include <simavr/avr/avr_mcu_section.h>
+
+AVR_MCU(F_CPU, "atmega328p");
+AVR_MCU_SIMAVR_CONSOLE(&GPIOR0);
+
+#ifdef LCD_ASYNC
+#define BENCH_IMAGE "async"
+#else
+#define BENCH_IMAGE "sync"
+#endif
+
+#define LCD_FRAMEBUFFER // As in feeder.c
+#include "OnLCDLib.h"
+
+#define M0 _BV(PB5)
+#define M1 _BV(PB4)
+#define M2 _BV(PB3)
+#define M3 _BV(PB2)
+#include "motor.h"
+#include "rtc.h"
+#include "schedule.h"
+#include "config.h"
+#include "log.h"
+
+// Keeps the compiler from moving work across the TCNT1 reads
+#define BENCH_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+#define BENCH(name, code) \
+	do { bench_begin(); code; bench_report(PSTR(name), bench_end()); bench_settle(); } while(0)
+
+uint16_t bench_start;
+uint16_t bench_overhead = 0;
+
+static inline void bench_begin(void)
+{
+	BENCH_BARRIER();
+	bench_start = TCNT1;
+	BENCH_BARRIER();
+}
+
+static inline uint16_t bench_end(void)
+{
+	uint16_t now;
+
+	BENCH_BARRIER();
+	now = TCNT1;
+	BENCH_BARRIER();
+	return now - bench_start - bench_overhead;
+}
+
+// Sends the queued bytes so the next case starts with an empty queue
+static void bench_settle(void)
+{
+	#ifdef LCD_ASYNC
+	while(LCDQueuePending()) LCDQueueTick();
+	#endif
+}
+
+static void bench_puts_P(const char *string)
+{
+	char c;
+
+	while((c = pgm_read_byte(string++))) GPIOR0 = c;
+}
+
+static void bench_report(const char *name, uint16_t cycles)
+{
+	char digits[5];
+	uint8_t i = 0;
+
+	bench_puts_P(PSTR("bench " BENCH_IMAGE " "));
+	bench_puts_P(name);
+	GPIOR0 = ' ';
+	do
+	{
+		digits[i++] = '0' + cycles % 10;
+		cycles /= 10;
+	} while(cycles);
+	while(i) GPIOR0 = digits[--i];
+	GPIOR0 = '\r'; // simavr prints the line
+}
+
+// Same calls as toScreen() in feeder.c, values in packed BCD
+static void toScreen(uint8_t seconds, uint8_t seconds_left)
+{
+	LCDFrameGotoXY(1, 1);
+	LCDFrameWriteFormat_P(PSTR("Current:%b:%b:%b"), 0x12, 0x00, seconds);
+
+	LCDFrameGotoXY(2, 2);
+	LCDFrameWriteFormat_P(PSTR("Left: %b:%b:%b"), 0x23, 0x59, seconds_left);
+
+	LCDFlush();
+}
+
+// The EEPROM that main() of feeder.c reads most from before its loop: every
+// config and clock slot valid and a log ring that log_init() scans to the end
+static void bench_boot_eeprom(void)
+{
+	config_t config;
+	uint8_t i;
+
+	memset(&config, 0, sizeof(config));
+	for(i = 0; i < CONFIG_SLOTS; i++) config_save(&config);
+	for(i = 0; i < CLOCK_SLOTS; i++) config_save_clock(i);
+	for(i = 0; i < LOG_SLOTS; i++) eeprom_update_byte(log_address(i, 0), LOG_BOOT << 4);
+}
+
+int main(void)
+{
+	config_t config;
+	uint16_t minute;
+
+	LCDSetup(LCD_CURSOR_NONE);
+	bench_settle(); // The async reset runs from LCDQueueTick
+
+	// Timer1 counts CPU cycles, motor_step() only writes OCR1A
+	TIMSK1 = 0;
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+	bench_begin();
+	bench_overhead = bench_end();
+
+	BENCH("LCDGotoXY", LCDGotoXY(1, 2));
+	BENCH("LCDWriteString", LCDWriteString("Current:"));
+	BENCH("LCDWriteInt", LCDWriteInt(12345, 5));
+
+	// The async image only counts building the frame and queueing the changed
+	// bytes. Their bus transfer comes later, a LCDQueueTick per byte.
+	toScreen(0x00, 0x59);
+	bench_settle();
+	BENCH("toScreen", toScreen(0x01, 0x58)); // One second: two digits change
+	BENCH("toScreen-ten", toScreen(0x10, 0x49)); // Tens roll over: four digits
+
+	#ifdef LCD_ASYNC
+	LCDWriteString("x");
+	BENCH("LCDQueueTick", LCDQueueTick());
+	#endif
+
+	MOTOR_DDR |= MOTOR_MASK;
+	motor_stride = 2;
+	motor_steps_left = 1000;
+	motor_steps_done = 0;
+	BENCH("motor_step-ramp", motor_step());
+	motor_steps_done = MOTOR_RAMP_STEPS;
+	BENCH("motor_step", motor_step());
+
+	// Boot after a power cut: the slot cache in .noinit is lost. These cases
+	// are most of the time from reset to the first button poll, which is only
+	// an estimate counted by hand (11 to 25 ms at 1 MHz) until simavr runs them.
+	bench_boot_eeprom();
+	config_cache.check ^= 0xFF;
+	BENCH("config_load", config_load(&config));
+	BENCH("config_load-cached", config_load(&config)); // Reset with RAM kept
+	config_cache.check ^= 0xFF;
+	BENCH("config_load_clock", config_load_clock(&minute));
+	BENCH("log_init", log_init());
+
+	// simavr stops on sleep with interrupts off
+	cli();
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	sleep_enable();
+	sleep_cpu();
+	return 0;
+}
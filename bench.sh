@@ -0,0 +1,91 @@
+#!/bin/sh
+# bench.sh - runs the bench images under simavr and compares with bench.baseline
+#
+# Called by "make bench" after bench_sync.elf, bench_async.elf and
+# feeder_bench.elf are built. Writes bench.out, one line per case:
+#	<image> <case> <cycles> <flash bytes> <stack bytes>
+# Sizes are those of the function named by the case in feeder_bench.elf and
+# feeder_bench.su, "-" when the compiler inlined it. A case that needs more
+# cycles, flash or stack than in bench.baseline by over TOLERANCE percent is
+# a regression and fails the run. "make bench-baseline" stores bench.out as
+# the new baseline. Without bench.baseline the run only prints bench.out and
+# never fails: none is committed yet, it needs an avr-gcc and simavr run.
+
+SIMAVR=${SIMAVR:-simavr}
+NM=${NM:-avr-nm}
+TOLERANCE=${TOLERANCE:-2}
+
+for image in sync async
+do
+	$SIMAVR bench_$image.elf 2>&1 | tr -d '\r' | sed -n 's/.*\(bench [a-z]* [^ ]* [0-9][0-9]*\).*/\1/p'
+done > bench.cycles
+
+if [ ! -s bench.cycles ]
+then
+	echo "bench: no results from $SIMAVR" >&2
+	exit 1
+fi
+
+$NM -S -t d -C feeder_bench.elf > bench.symbols
+
+awk -v symbols=bench.symbols -v stack_usage=feeder_bench.su '
+BEGIN {
+	# Names of a C++ build come demangled with their arguments, the .su
+	# lines as "file:line:column:type name(arguments)"
+	while((getline line < symbols) > 0)
+	{
+		if(split(line, f, " ") < 4 || f[3] !~ /^[Tt]$/) continue
+		name = line
+		sub(/^[^ ]+ [^ ]+ [^ ]+ /, "", name)
+		sub(/\(.*/, "", name)
+		flash[name] = f[2] + 0
+	}
+	while((getline line < stack_usage) > 0)
+	{
+		split(line, f, "\t")
+		name = f[1]
+		sub(/\(.*/, "", name)
+		sub(/.* /, "", name)
+		sub(/.*:/, "", name)
+		stack[name] = f[2]
+	}
+}
+{
+	name = $3
+	sub(/-.*/, "", name)
+	print $2, $3, $4, (name in flash) ? flash[name] : "-", (name in stack) ? stack[name] : "-"
+}' bench.cycles > bench.out
+rm -f bench.cycles bench.symbols
+
+if [ ! -f bench.baseline ]
+then
+	cat bench.out
+	echo "bench: no bench.baseline, store these numbers with make bench-baseline"
+	exit 0
+fi
+
+awk -v tolerance="$TOLERANCE" '
+function field(value, base)
+{
+	if(base == "" || base == "-" || value == "-" || value == base) return sprintf("%7s        ", value)
+	return sprintf("%7s (%+5d)", value, value - base)
+}
+NR == FNR { baseline[$1 " " $2] = $0; next }
+FNR == 1 { printf("%-6s %-18s %7s         %7s         %7s\n", "image", "case", "cycles", "flash", "stack") }
+{
+	split(baseline[$1 " " $2], b, " ")
+	status = ($1 " " $2) in baseline ? "" : "  new"
+	for(i = 3; i <= 5; i++)
+	{
+		if($i != "-" && b[i] != "" && b[i] != "-" && $i * 100 > b[i] * (100 + tolerance)) status = "  REGRESSION"
+	}
+	if(status == "  REGRESSION") failed++
+	printf("%-6s %-18s %s %s %s%s\n", $1, $2, field($3, b[3]), field($4, b[4]), field($5, b[5]), status)
+}
+END {
+	if(failed)
+	{
+		printf("bench: %d regression(s) over %d%%\n", failed, tolerance)
+		exit 1
+	}
+}' bench.baseline bench.out
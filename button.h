@@ -0,0 +1,134 @@
+/*_______________________________________________________________________________
+button.h - Interrupt driven, debounced push button with an event queue
+
+The pin change interrupt catches every edge of the button, even while the main
+loop is busy. The first edge is taken at once and stamped with rtc_now();
+bounces inside BUTTON_DEBOUNCE_MS are ignored, and button_tick() corrects the
+state if the pin settled on the other level. Press, release and long press
+events go into a small single producer / single consumer queue that the main
+loop reads with button_event().
+
+HOW TO USE
+----------
+- Define BUTTON (bit on PORTB, high when pressed) and PIN (PINB) and include
+  rtc.h before this file.
+- Call button_tick() from RTC_TICK_HOOK (declare it before including rtc.h).
+  With RTC_CRYSTAL keep rtc_fast_ticks() on while button_busy() is set.
+- button_init() once, then sei()
+- while(button_event(&event)) { ... event.type, event.time ... }
+__________________________________________________________________________________*/
+
+#ifndef BUTTON_H
+#define BUTTON_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#ifndef BUTTON_DEBOUNCE_MS
+#define BUTTON_DEBOUNCE_MS 20
+#endif
+#ifndef BUTTON_LONG_MS
+#define BUTTON_LONG_MS 1000
+#endif
+#define BUTTON_QUEUE_SIZE 8 // power of 2
+
+#define BUTTON_DEBOUNCE_TICKS ((uint16_t)((uint32_t)BUTTON_DEBOUNCE_MS * RTC_TICKS_PER_SECOND / 1000 + 1))
+#define BUTTON_LONG_TICKS ((uint16_t)((uint32_t)BUTTON_LONG_MS * RTC_TICKS_PER_SECOND / 1000))
+
+#define BUTTON_PRESS 0
+#define BUTTON_RELEASE 1
+#define BUTTON_LONG 2
+
+typedef struct
+{
+	uint8_t type;
+	uint16_t time; // rtc_now() of the edge
+} button_event_t;
+
+button_event_t button_queue[BUTTON_QUEUE_SIZE];
+volatile uint8_t button_head = 0; // Written by the ISRs only
+volatile uint8_t button_tail = 0; // Written by button_event() only
+
+volatile uint8_t button_state = 0; // Debounced level, 1 = pressed
+volatile uint16_t button_edge_time = 0;
+volatile uint8_t button_long_sent = 0;
+
+static void button_push(uint8_t type, uint16_t time)
+{
+	uint8_t head = button_head;
+	uint8_t next = (head + 1) & (BUTTON_QUEUE_SIZE - 1);
+
+	if(next == button_tail) return; // Full, drop the event
+
+	button_queue[head].type = type;
+	button_queue[head].time = time;
+	button_head = next; // Publish after the slot is filled
+}
+
+static void button_edge(uint8_t level, uint16_t now)
+{
+	button_state = level;
+	button_edge_time = now;
+	button_long_sent = 0;
+	button_push(level ? BUTTON_PRESS : BUTTON_RELEASE, now);
+}
+
+void button_init(void)
+{
+	DDRB &= ~(1 << BUTTON);
+	button_state = (PIN >> BUTTON) & 1;
+	button_edge_time = rtc_now();
+
+	PCMSK0 |= (1 << BUTTON); // PB0..PB7 are PCINT0..PCINT7
+	PCIFR = (1 << PCIF0);
+	PCICR |= (1 << PCIE0);
+}
+
+uint8_t button_event(button_event_t *event)
+{
+	uint8_t tail = button_tail;
+
+	if(tail == button_head) return 0;
+
+	*event = button_queue[tail];
+	button_tail = (tail + 1) & (BUTTON_QUEUE_SIZE - 1);
+	return 1;
+}
+
+// Pressed, or an edge is still inside the debounce time
+uint8_t button_busy(void)
+{
+	return button_state || (uint16_t)(rtc_now() - button_edge_time) < BUTTON_DEBOUNCE_TICKS;
+}
+
+// Called from the RTC tick, in interrupt context
+void button_tick(void)
+{
+	uint16_t now = rtc_now();
+	uint16_t held = now - button_edge_time;
+	uint8_t level = (PIN >> BUTTON) & 1;
+
+	if(level != button_state)
+	{
+		// The last bounce fell inside the debounce time and was dropped
+		if(held >= BUTTON_DEBOUNCE_TICKS) button_edge(level, now);
+	}
+	else if(button_state && !button_long_sent && held >= BUTTON_LONG_TICKS)
+	{
+		button_long_sent = 1;
+		button_push(BUTTON_LONG, now);
+	}
+}
+
+ISR(PCINT0_vect)
+{
+	uint16_t now = rtc_now();
+	uint8_t level = (PIN >> BUTTON) & 1;
+
+	if(level == button_state) return; // Bounced back
+	if((uint16_t)(now - button_edge_time) < BUTTON_DEBOUNCE_TICKS) return;
+
+	button_edge(level, now);
+}
+
+#endif // BUTTON_H
@@ -0,0 +1,153 @@
+/*_______________________________________________________________________________
+clock.h - Run time CPU clock scaling with CLKPR
+
+The CPU runs from the 8 MHz internal RC oscillator. The CKDIV8 fuse makes
+CLKPR divide it by 8 at reset, which is F_CPU (1 MHz). clock_set() changes the
+divider while the program runs:
+
+	CLOCK_FAST	8 MHz	bursts of CPU work, e.g. building and diffing a frame
+	CLOCK_BASE	1 MHz	F_CPU, everything is set up for this clock
+	CLOCK_SLOW	125 kHz	waiting in idle sleep with little to do
+
+A level is a CLKPR divider exponent (clock = 8 MHz >> level). Switching keeps
+every clock derived from the CPU at its F_CPU rate:
+- Timer0, Timer1 and a synchronous Timer2 get the prescaler that gives the same
+  count rate, so the motor steps and the RTC ticks do not change. An
+  asynchronous Timer2 (RTC_CRYSTAL) runs from the crystal and is left alone.
+- UBRR0 is scaled with the clock, the baud rate stays the same. Each switch
+  moves the bit timing once by at most one baud clock (1/8 bit at U2X).
+If a running timer or the USART cannot follow exactly (no prescaler for the
+new rate, UBRR0 not divisible), clock_set() refuses and the clock stays.
+
+_delay_ms() and _delay_us() count cycles of F_CPU: they are 8 times shorter
+at CLOCK_FAST and 8 times longer at CLOCK_SLOW. Minimum delays (LCD strobes)
+use CLOCK_DELAY_US(), which is never shorter than asked. Anything that
+measures against F_CPU (rtc_tune_cpu(), LCDSetup() and its long delays) runs
+at CLOCK_BASE.
+
+8 MHz needs a supply of 2.4 V or more (4 MHz down to 1.8 V). At 125 kHz an ISR
+takes 8 times longer in real time: the motor chop periods (250 us) and the
+1 kHz RTC tick of the synchronous RTC are too short for it, so only wait slow
+with Timer1 stopped and the crystal RTC.
+
+HOW TO USE
+----------
+- Set up the peripherals (rtc_init(), motor_init(), console_init()) at
+  CLOCK_BASE, clock_set() only converts what is already running.
+- Include this file before OnLCDLib.h and motor.h, and define
+	#define LCD_DELAY_US(us) CLOCK_DELAY_US(us)
+	#define MOTOR_CLOCK_SELECT clock_timer1(1 << CS11)
+  so the LCD strobes and a motor started at any level keep their timing.
+- clock_set(level) returns 1 if the CPU now runs at "level", 0 if it was
+  refused. clock_level holds the current level.
+- Keep bursts short and go back to CLOCK_BASE after them:
+	clock_set(CLOCK_FAST); ...work...; clock_set(CLOCK_BASE);
+- A switch runs with interrupts off for about 150 cycles (prescaler lookups).
+__________________________________________________________________________________*/
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+
+#ifndef CLOCK_BASE
+#define CLOCK_BASE 3 // CLKPR at reset with CKDIV8, 8 MHz / 8 = F_CPU
+#endif
+#ifndef CLOCK_FAST
+#define CLOCK_FAST 0 // 8 MHz
+#endif
+#ifndef CLOCK_SLOW
+#define CLOCK_SLOW 6 // 125 kHz, the slowest clock the prescalers can follow
+#endif
+#if CLOCK_FAST > CLOCK_BASE || CLOCK_SLOW < CLOCK_BASE || CLOCK_SLOW > 8
+	#error "Clock levels must be CLOCK_FAST <= CLOCK_BASE <= CLOCK_SLOW <= 8"
+#endif
+
+#define CLOCK_SELECT_MASK ((1 << CS12) | (1 << CS11) | (1 << CS10)) // Same bits in all timers
+#define CLOCK_NONE 0xFF
+
+// Not shorter than "us" at any level (a constant, like for _delay_us())
+#define CLOCK_DELAY_US(us) do { \
+	if(clock_level < CLOCK_BASE) _delay_us((us) * (1 << (CLOCK_BASE - CLOCK_FAST))); \
+	else _delay_us(us); \
+} while(0)
+
+// log2 of the prescaler of each clock select value
+static const uint8_t clock_timer1_shifts[8] PROGMEM = {
+	CLOCK_NONE, 0, 3, 6, 8, 10, CLOCK_NONE, CLOCK_NONE // Timer0 too
+};
+static const uint8_t clock_timer2_shifts[8] PROGMEM = {
+	CLOCK_NONE, 0, 3, 5, 6, 7, 8, 10
+};
+
+uint8_t clock_level = CLOCK_BASE;
+
+// Clock select that keeps the count rate of "select" when the CPU clock is
+// multiplied by 2^faster (negative: divided). 0 if no prescaler fits, the
+// stopped and external selects are returned as they are.
+static uint8_t clock_follow(const uint8_t *shifts, uint8_t select, int8_t faster)
+{
+	uint8_t shift = pgm_read_byte(&shifts[select]), i;
+
+	if(shift == CLOCK_NONE) return select;
+	for(i = 1; i < 8; i++)
+	{
+		if(pgm_read_byte(&shifts[i]) == (uint8_t)(shift + faster)) return i;
+	}
+	return 0;
+}
+
+// Timer1 clock select giving the rate "select" gives at CLOCK_BASE
+uint8_t clock_timer1(uint8_t select)
+{
+	return clock_follow(clock_timer1_shifts, select, CLOCK_BASE - clock_level);
+}
+
+uint8_t clock_set(uint8_t level)
+{
+	int8_t faster = clock_level - level;
+	uint8_t timer0, timer1, timer2, ok = 1;
+	uint16_t ubrr;
+
+	if(faster == 0) return 1;
+
+	uint8_t sreg = SREG;
+	cli();
+
+	timer0 = clock_follow(clock_timer1_shifts, TCCR0B & CLOCK_SELECT_MASK, faster);
+	timer1 = clock_follow(clock_timer1_shifts, TCCR1B & CLOCK_SELECT_MASK, faster);
+	timer2 = TCCR2B & CLOCK_SELECT_MASK;
+	if(!(ASSR & (1 << AS2))) timer2 = clock_follow(clock_timer2_shifts, timer2, faster);
+	if((TCCR0B & CLOCK_SELECT_MASK) && !timer0) ok = 0;
+	if((TCCR1B & CLOCK_SELECT_MASK) && !timer1) ok = 0;
+	if((TCCR2B & CLOCK_SELECT_MASK) && !timer2) ok = 0;
+
+	ubrr = UBRR0 + 1;
+	if(UCSR0B & ((1 << RXEN0) | (1 << TXEN0)))
+	{
+		if(faster > 0) ubrr <<= faster;
+		else if(ubrr & ((1 << -faster) - 1)) ok = 0;
+		else ubrr >>= -faster;
+		if(ubrr > 4096) ok = 0;
+	}
+
+	if(ok)
+	{
+		CLKPR = (1 << CLKPCE); // The new value must follow within 4 cycles
+		CLKPR = level;
+		TCCR0B = (TCCR0B & ~CLOCK_SELECT_MASK) | timer0;
+		TCCR1B = (TCCR1B & ~CLOCK_SELECT_MASK) | timer1;
+		// Asynchronous Timer2 registers are not written, that would need an
+		// ASSR busy wait
+		if(!(ASSR & (1 << AS2))) TCCR2B = (TCCR2B & ~CLOCK_SELECT_MASK) | timer2;
+		if(UCSR0B & ((1 << RXEN0) | (1 << TXEN0))) UBRR0 = ubrr - 1;
+		clock_level = level;
+	}
+	SREG = sreg;
+	return ok;
+}
+
+#endif // CLOCK_H
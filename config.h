@@ -0,0 +1,288 @@
+/*_______________________________________________________________________________
+config.h - EEPROM configuration and clock checkpoints
+
+The configuration (feeding schedule, portions, cruise step period) and the
+clock are stored in two rings of EEPROM slots. Every save goes to the slot
+after the newest one, so writes are spread over all slots of a ring. Each
+record carries a sequence number and a CRC: a save interrupted by a power cut
+fails the CRC and the previous record stays the newest.
+
+Boot reads each ring once and keeps the newest valid record. The slot index is
+also cached in a .noinit RAM section; after a reset that kept RAM (watchdog,
+brown-out, reset button) the cached slot is checked and the scan is skipped.
+
+EEPROM MAP (1 KB on the ATmega328P)
+-----------------------------------
+	0   - 191	configuration, 4 slots of 48 bytes
+	192 - 319	clock, 32 slots of 4 bytes
+	320 - 1020	free (CONFIG_FREE_START to CONFIG_FREE_END)
+	1021 - 1023	RTC trim, one record, rewritten only when the trim changes
+
+HOW TO USE
+----------
+- Include schedule.h and motor.h first (for feeding_t, SCHEDULE_MAX and the
+  cruise period limits)
+- config_load(&config) returns 1 and fills "config" if a valid record exists,
+  otherwise "config" is left untouched. A cruise_us outside MOTOR_MIN_US to
+  MOTOR_MAX_US is replaced by MOTOR_CRUISE_US.
+- config_save(&config) writes a new record (blocks ~3.3 ms per changed byte)
+- config_load_clock(&minute) / config_save_clock(minute) do the same for the
+  minute of the day. Save it every few minutes; with 32 slots a checkpoint
+  every 10 minutes writes each cell 4.5 times a day. CONFIG_CLOCK_USED can be
+  or'ed into the minute, config_load_clock() returns it as saved.
+- config_load_trim(&trim) / config_save_trim(trim) keep the RTC trim
+  (rtc_get_trim() in rtc.h). It changes at most once per clock reference, so
+  a single record is enough.
+__________________________________________________________________________________*/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#define CONFIG_VERSION 1
+
+#define CONFIG_SLOTS 4
+#define CONFIG_SLOT_SIZE 48
+#define CONFIG_START 0
+#define CLOCK_SLOTS 32
+#define CLOCK_SLOT_SIZE 4
+#define CLOCK_START (CONFIG_START + CONFIG_SLOTS * CONFIG_SLOT_SIZE)
+#define CONFIG_FREE_START (CLOCK_START + CLOCK_SLOTS * CLOCK_SLOT_SIZE)
+#define CONFIG_TRIM_SIZE 3
+#define CONFIG_TRIM_START (E2END + 1 - CONFIG_TRIM_SIZE)
+#define CONFIG_FREE_END CONFIG_TRIM_START
+
+#define CONFIG_NONE 0xFF
+#define CONFIG_CLOCK_USED 0x8000 // Free flag bit in the clock minute
+#define CONFIG_EEPROM(address) ((uint8_t *)(uintptr_t)(address))
+
+typedef struct
+{
+	uint8_t version;
+	uint8_t sequence;
+	uint8_t count; // Number of used entries in "feedings"
+	feeding_t feedings[SCHEDULE_MAX];
+	uint16_t cruise_us;
+	uint16_t crc; // Over all the bytes above
+} __attribute__((packed)) config_t; // Same layout on the host as on the AVR
+
+typedef struct
+{
+	uint8_t sequence;
+	uint16_t minute;
+	uint8_t crc;
+} __attribute__((packed)) config_clock_t;
+
+typedef struct
+{
+	int16_t trim;
+	uint8_t crc;
+} __attribute__((packed)) config_trim_t;
+
+typedef struct
+{
+	uint8_t config_index, config_sequence;
+	uint8_t clock_index, clock_sequence;
+	uint8_t check;
+} config_cache_t;
+
+// A record must fit its slot
+typedef char config_fits_slot[(sizeof(config_t) <= CONFIG_SLOT_SIZE) ? 1 : -1];
+typedef char config_clock_fits_slot[(sizeof(config_clock_t) <= CLOCK_SLOT_SIZE) ? 1 : -1];
+typedef char config_trim_fits_slot[(sizeof(config_trim_t) <= CONFIG_TRIM_SIZE) ? 1 : -1];
+
+// Survives resets that do not remove power, checked before it is trusted
+config_cache_t config_cache __attribute__((section(".noinit")));
+
+static uint16_t config_crc(const config_t *config)
+{
+	const uint8_t *byte = (const uint8_t *)config;
+	uint16_t crc = 0xFFFF;
+	uint8_t i;
+
+	for(i = 0; i < sizeof(config_t) - sizeof(config->crc); i++) crc = _crc16_update(crc, byte[i]);
+	return crc;
+}
+
+static uint8_t config_clock_crc(const config_clock_t *clock)
+{
+	uint8_t crc = 0;
+
+	crc = _crc8_ccitt_update(crc, clock->sequence);
+	crc = _crc8_ccitt_update(crc, clock->minute & 0xFF);
+	crc = _crc8_ccitt_update(crc, clock->minute >> 8);
+	return crc;
+}
+
+static uint8_t config_trim_crc(const config_trim_t *record)
+{
+	uint8_t crc = 0;
+
+	crc = _crc8_ccitt_update(crc, record->trim & 0xFF);
+	crc = _crc8_ccitt_update(crc, record->trim >> 8);
+	return crc ^ 0x5A; // An erased record (0xFF...) must not pass
+}
+
+static uint8_t config_cache_check(void)
+{
+	return 0xA5 ^ config_cache.config_index ^ config_cache.config_sequence
+		^ config_cache.clock_index ^ config_cache.clock_sequence;
+}
+
+static void config_cache_update(void)
+{
+	config_cache.check = config_cache_check();
+}
+
+// Forget the cache if RAM did not survive the reset
+static void config_cache_validate(void)
+{
+	if(config_cache.check == config_cache_check()) return;
+
+	config_cache.config_index = CONFIG_NONE;
+	config_cache.clock_index = CONFIG_NONE;
+	config_cache_update();
+}
+
+static uint8_t config_read(uint8_t index, config_t *config)
+{
+	eeprom_read_block(config, CONFIG_EEPROM(CONFIG_START + index * CONFIG_SLOT_SIZE), sizeof(config_t));
+	if(config->version != CONFIG_VERSION || config->count > SCHEDULE_MAX
+		|| config->crc != config_crc(config)) return 0;
+
+	// 0 would underflow MOTOR_US_TO_TICKS() into the slowest possible step
+	if(config->cruise_us < MOTOR_MIN_US || config->cruise_us > MOTOR_MAX_US) config->cruise_us = MOTOR_CRUISE_US;
+	return 1;
+}
+
+static uint8_t config_read_clock(uint8_t index, config_clock_t *clock)
+{
+	eeprom_read_block(clock, CONFIG_EEPROM(CLOCK_START + index * CLOCK_SLOT_SIZE), sizeof(config_clock_t));
+	return clock->crc == config_clock_crc(clock) && (clock->minute & ~CONFIG_CLOCK_USED) < 24 * 60;
+}
+
+uint8_t config_load(config_t *config)
+{
+	config_t slot;
+	uint8_t i, best = CONFIG_NONE;
+
+	config_cache_validate();
+
+	// Fast path, the cached slot still holds the record we wrote last
+	i = config_cache.config_index;
+	if(i < CONFIG_SLOTS && config_read(i, &slot) && slot.sequence == config_cache.config_sequence)
+	{
+		*config = slot;
+		return 1;
+	}
+
+	// One pass over the ring, newest valid record wins
+	for(i = 0; i < CONFIG_SLOTS; i++)
+	{
+		if(!config_read(i, &slot)) continue;
+		if(best == CONFIG_NONE || (int8_t)(slot.sequence - config->sequence) > 0)
+		{
+			*config = slot;
+			best = i;
+		}
+	}
+
+	if(best == CONFIG_NONE) return 0;
+
+	config_cache.config_index = best;
+	config_cache.config_sequence = config->sequence;
+	config_cache_update();
+	return 1;
+}
+
+void config_save(config_t *config)
+{
+	uint8_t index = config_cache.config_index;
+
+	if(index >= CONFIG_SLOTS) index = 0;
+	else if(++index >= CONFIG_SLOTS) index = 0;
+
+	config->version = CONFIG_VERSION;
+	config->sequence = config_cache.config_sequence + 1;
+	config->crc = config_crc(config);
+	eeprom_update_block(config, CONFIG_EEPROM(CONFIG_START + index * CONFIG_SLOT_SIZE), sizeof(config_t));
+
+	config_cache.config_index = index;
+	config_cache.config_sequence = config->sequence;
+	config_cache_update();
+}
+
+uint8_t config_load_clock(uint16_t *minute)
+{
+	config_clock_t slot, newest;
+	uint8_t i, best = CONFIG_NONE;
+
+	config_cache_validate();
+
+	i = config_cache.clock_index;
+	if(i < CLOCK_SLOTS && config_read_clock(i, &newest) && newest.sequence == config_cache.clock_sequence)
+	{
+		*minute = newest.minute;
+		return 1;
+	}
+
+	for(i = 0; i < CLOCK_SLOTS; i++)
+	{
+		if(!config_read_clock(i, &slot)) continue;
+		if(best == CONFIG_NONE || (int8_t)(slot.sequence - newest.sequence) > 0)
+		{
+			newest = slot;
+			best = i;
+		}
+	}
+
+	if(best == CONFIG_NONE) return 0;
+
+	config_cache.clock_index = best;
+	config_cache.clock_sequence = newest.sequence;
+	config_cache_update();
+	*minute = newest.minute;
+	return 1;
+}
+
+void config_save_clock(uint16_t minute)
+{
+	config_clock_t clock;
+	uint8_t index = config_cache.clock_index;
+
+	if(index >= CLOCK_SLOTS) index = 0;
+	else if(++index >= CLOCK_SLOTS) index = 0;
+
+	clock.sequence = config_cache.clock_sequence + 1;
+	clock.minute = minute;
+	clock.crc = config_clock_crc(&clock);
+	eeprom_update_block(&clock, CONFIG_EEPROM(CLOCK_START + index * CLOCK_SLOT_SIZE), sizeof(config_clock_t));
+
+	config_cache.clock_index = index;
+	config_cache.clock_sequence = clock.sequence;
+	config_cache_update();
+}
+
+uint8_t config_load_trim(int16_t *trim)
+{
+	config_trim_t record;
+
+	eeprom_read_block(&record, CONFIG_EEPROM(CONFIG_TRIM_START), sizeof(config_trim_t));
+	if(record.crc != config_trim_crc(&record)) return 0;
+	*trim = record.trim;
+	return 1;
+}
+
+void config_save_trim(int16_t trim)
+{
+	config_trim_t record;
+
+	record.trim = trim;
+	record.crc = config_trim_crc(&record);
+	eeprom_update_block(&record, CONFIG_EEPROM(CONFIG_TRIM_START), sizeof(config_trim_t));
+}
+
+#endif // CONFIG_H
@@ -0,0 +1,297 @@
+/*_______________________________________________________________________________
+console.h - Interrupt driven USART0 console with a line parser
+
+Received bytes go into an RX ring from USART_RX_vect, output leaves from a TX
+ring through USART_UDRE_vect. Neither side ever waits: a full TX ring drops
+the character (console_dropped counts them), a full RX ring drops the rest of
+the line and keeps one byte free for its end so the line is still closed.
+
+Commands are parsed in place: the main loop reads the oldest complete line
+straight out of the RX ring with the console_word() / console_read_number()
+token functions, then frees it with console_next_line(). Nothing is copied
+and nothing is allocated. The commands themselves live in the application.
+
+The byte level work is done by console_receive() and console_transmit(),
+which the ISRs call. A host build can feed them from a pipe or pty instead.
+
+PINS
+----
+RXD is PD0 and TXD is PD1, the default LCD RS and R/W pins of OnLCDLib.h.
+Define LCD_RS_PIN and LCD_RW_PIN (e.g. PD3 and PD4) before including
+OnLCDLib.h and wire the LCD there. USART clocks stop in power-save sleep, so
+keep the CPU in idle sleep while the console is in use.
+
+HOW TO USE
+----------
+- console_init() once, then sei(). 9600 8N1 by default (CONSOLE_BAUD).
+- Output: console_putc(c), console_puts_P(PSTR("...")), console_number(value,
+  digits), console_newline(). console_room() is the free space in the TX ring.
+- Input, on every main loop pass:
+	if(console_line())
+	{
+		if(console_word(PSTR("feed")) && console_end()) ...
+		else if(console_word(PSTR("time")) && console_read_time(&h, &m, &s)) ...
+		console_next_line();
+	}
+  console_word() and console_read_number() only move past the token when it
+  matches. console_end() is true when nothing but spaces is left.
+__________________________________________________________________________________*/
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#ifndef CONSOLE_BAUD
+#define CONSOLE_BAUD 9600
+#endif
+#define CONSOLE_RX_SIZE 64 // power of 2, longest line is one less
+#define CONSOLE_TX_SIZE 64 // power of 2
+
+#define CONSOLE_UBRR ((F_CPU + 4UL * CONSOLE_BAUD) / (8UL * CONSOLE_BAUD) - 1) // Double speed
+
+char console_rx[CONSOLE_RX_SIZE];
+volatile uint8_t console_rx_head = 0; // Written by the RX ISR only
+uint8_t console_rx_tail = 0; // Start of the oldest line, main loop only
+uint8_t console_pos = 0; // Parser position inside that line
+volatile uint8_t console_lines = 0; // Complete lines in the ring
+
+char console_tx[CONSOLE_TX_SIZE];
+uint8_t console_tx_head = 0; // Written by the main loop only
+volatile uint8_t console_tx_tail = 0; // Written by the UDRE ISR only
+uint8_t console_dropped = 0;
+
+void console_init(void)
+{
+	UBRR0 = CONSOLE_UBRR;
+	UCSR0A = (1 << U2X0);
+	UCSR0C = (1 << UCSZ01) | (1 << UCSZ00); // 8N1
+	UCSR0B = (1 << RXCIE0) | (1 << RXEN0) | (1 << TXEN0);
+}
+
+// Called with every received byte, in interrupt context
+void console_receive(char c)
+{
+	uint8_t head = console_rx_head;
+	uint8_t free = (console_rx_tail - head - 1) & (CONSOLE_RX_SIZE - 1);
+
+	// '\0' ends a line in the ring, a received one would split a line
+	// without counting it in console_lines
+	if(c == '\0') return;
+	if(c == '\r' || c == '\n')
+	{
+		// Skip empty lines, e.g. the \n of \r\n
+		if(head == console_rx_tail || console_rx[(head - 1) & (CONSOLE_RX_SIZE - 1)] == '\0') return;
+		if(!free) return;
+		console_rx[head] = '\0';
+		console_rx_head = (head + 1) & (CONSOLE_RX_SIZE - 1);
+		console_lines++;
+		return;
+	}
+
+	if(free <= 1) return; // The last byte is kept for the end of the line
+	console_rx[head] = c;
+	console_rx_head = (head + 1) & (CONSOLE_RX_SIZE - 1);
+}
+
+// Next byte to send, 0 if the TX ring is empty. Interrupt context.
+uint8_t console_transmit(char *c)
+{
+	uint8_t tail = console_tx_tail;
+
+	if(tail == console_tx_head) return 0;
+	*c = console_tx[tail];
+	console_tx_tail = (tail + 1) & (CONSOLE_TX_SIZE - 1);
+	return 1;
+}
+
+uint8_t console_room(void)
+{
+	return (console_tx_tail - console_tx_head - 1) & (CONSOLE_TX_SIZE - 1);
+}
+
+void console_putc(char c)
+{
+	uint8_t head = console_tx_head;
+	uint8_t next = (head + 1) & (CONSOLE_TX_SIZE - 1);
+
+	if(next == console_tx_tail)
+	{
+		if(console_dropped < 0xFF) console_dropped++;
+		return;
+	}
+	console_tx[head] = c;
+	console_tx_head = next;
+	UCSR0B |= (1 << UDRIE0); // The UDRE ISR is the only one to clear it
+}
+
+void console_puts_P(const char *string)
+{
+	char c;
+
+	while((c = pgm_read_byte(string++))) console_putc(c);
+}
+
+void console_newline(void)
+{
+	console_putc('\r');
+	console_putc('\n');
+}
+
+// "digits" wide with leading zeros, 0 for as many as needed
+void console_number(uint16_t number, uint8_t digits)
+{
+	static const uint16_t powers[] = {1, 10, 100, 1000, 10000};
+	uint8_t i = 5;
+	char digit;
+
+	if(!digits)
+	{
+		digits = 1;
+		while(digits < 5 && number >= powers[digits]) digits++;
+	}
+	while(i--)
+	{
+		for(digit = '0'; number >= powers[i]; digit++) number -= powers[i];
+		if(i < digits) console_putc(digit);
+	}
+}
+
+uint8_t console_line(void)
+{
+	return console_lines != 0;
+}
+
+static char console_peek(void)
+{
+	return console_rx[console_pos];
+}
+
+static void console_advance(void)
+{
+	console_pos = (console_pos + 1) & (CONSOLE_RX_SIZE - 1);
+}
+
+static void console_skip_spaces(void)
+{
+	while(console_peek() == ' ' || console_peek() == '\t') console_advance();
+}
+
+static uint8_t console_token_end(char c)
+{
+	return c == '\0' || c == ' ' || c == '\t';
+}
+
+// Matches the next token against "word" (in flash)
+uint8_t console_word(const char *word)
+{
+	uint8_t pos;
+	char c;
+
+	console_skip_spaces();
+	pos = console_pos;
+	while((c = pgm_read_byte(word++)))
+	{
+		if(console_rx[pos] != c) return 0;
+		pos = (pos + 1) & (CONSOLE_RX_SIZE - 1);
+	}
+	if(!console_token_end(console_rx[pos])) return 0;
+
+	console_pos = pos;
+	return 1;
+}
+
+// Decimal number, ends at a space, ':' or the end of the line
+uint8_t console_read_number(uint16_t *value)
+{
+	uint8_t pos;
+	uint16_t number = 0;
+	char c;
+
+	console_skip_spaces();
+	pos = console_pos;
+	c = console_rx[pos];
+	if(c < '0' || c > '9') return 0;
+	while(c >= '0' && c <= '9')
+	{
+		if(number > 6553 || (number == 6553 && c > '5')) return 0; // Overflow
+		number = number * 10 + (c - '0');
+		pos = (pos + 1) & (CONSOLE_RX_SIZE - 1);
+		c = console_rx[pos];
+	}
+	if(!console_token_end(c) && c != ':') return 0;
+
+	console_pos = pos;
+	*value = number;
+	return 1;
+}
+
+// HH:MM or HH:MM:SS
+uint8_t console_read_time(uint8_t *hours, uint8_t *minutes, uint8_t *seconds)
+{
+	uint8_t start = console_pos;
+	uint16_t h = 0, m = 0, s = 0;
+	uint8_t ok = console_read_number(&h) && console_peek() == ':';
+
+	if(ok)
+	{
+		console_advance();
+		ok = console_read_number(&m);
+	}
+	if(ok && console_peek() == ':')
+	{
+		console_advance();
+		ok = console_read_number(&s);
+	}
+	if(!ok || h > 23 || m > 59 || s > 59)
+	{
+		console_pos = start;
+		return 0;
+	}
+
+	*hours = h;
+	*minutes = m;
+	*seconds = s;
+	return 1;
+}
+
+uint8_t console_end(void)
+{
+	console_skip_spaces();
+	return console_peek() == '\0';
+}
+
+// Frees the oldest line, the parser moves to the next one
+void console_next_line(void)
+{
+	uint8_t sreg;
+
+	if(!console_lines) return;
+	while(console_rx[console_rx_tail] != '\0') console_rx_tail = (console_rx_tail + 1) & (CONSOLE_RX_SIZE - 1);
+	console_rx_tail = (console_rx_tail + 1) & (CONSOLE_RX_SIZE - 1);
+	console_pos = console_rx_tail;
+
+	sreg = SREG;
+	cli();
+	console_lines--;
+	SREG = sreg;
+}
+
+ISR(USART_RX_vect)
+{
+	char c = UDR0;
+
+	console_receive(c);
+}
+
+ISR(USART_UDRE_vect)
+{
+	char c;
+
+	if(console_transmit(&c)) UDR0 = c;
+	else UCSR0B &= ~(1 << UDRIE0);
+}
+
+#endif // CONSOLE_H
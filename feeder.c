@@ -1,7 +1,32 @@
+#include "hal.h"
 #include <avr/io.h>
 #include <util/delay.h>
+
+//#define CONSOLE // 9600 8N1 console on the USART (PD0/PD1)
+#ifdef CONSOLE
+#define LCD_RS_PIN PD3 // The USART takes PD0/PD1, wire LCD RS and R/W here
+#define LCD_RW_PIN PD4
+#endif
+
+#include "clock.h" // 8 MHz bursts, 125 kHz waits (see the main loop)
+#define LCD_DELAY_US(us) CLOCK_DELAY_US(us)
+#define MOTOR_CLOCK_SELECT clock_timer1(1 << CS11)
+
+//#define RTC_CRYSTAL // 32.768 kHz crystal on PB6/PB7, sleep in power-save between ticks
+
+#define LCD_FRAMEBUFFER // toScreen() draws into a frame, LCDFlush() sends the changes
+#define LCD_ASYNC // LCD bytes are sent from the RTC tick
+#ifdef RTC_CRYSTAL
+#define LCD_QUEUE_TICK_US 3906 // 256 Hz
+#endif
+void rtc_fast_ticks(uint8_t on);
+#define LCD_QUEUE_WAIT_HOOK() rtc_fast_ticks(1) // With RTC_CRYSTAL the tick only runs on demand
 #include "OnLCDLib.h"
 
+void button_tick(void);
+#define RTC_TICK_HOOK() { LCDQueueTick(); button_tick(); }
+#include "rtc.h"
+
 #define START_HOUR 9 + 12
 #define START_MINUTE 35
 
@@ -10,6 +35,8 @@
 
 #define TIME_WINDOW 20
 
+#define CHECKPOINT_MINUTES 10 // Clock saved to EEPROM this often
+
 #define HOUR 60
 
 #define MDELAY 2500
@@ -22,26 +49,51 @@
 #define ROT 128
 #define RIGHT 1
 #define LEFT 0
+#define STEP_MODE MOTOR_WAVE // MOTOR_WAVE, MOTOR_FULL or MOTOR_HALF (needs 2x ROT)
 
 #define BUTTON PB0
 #define PIN PINB
 
-uint8_t USED = 0;
+#include "motor.h"
+#include "button.h"
+#include "schedule.h"
+#include "config.h"
+#include "log.h"
+#ifdef CONSOLE
+#include "console.h"
+#endif
 
-void initMotor(void)
-{
-	DDRB = 0xFF; // all B as output
-    PORTB = 0x00; // all low
-}
+#define FEED_IDLE 0
+#define FEED_LEFT 1
+#define FEED_RIGHT 2
 
-void initButton(void)
+uint8_t feed_state = FEED_IDLE;
+uint16_t feed_steps = 0;
+uint16_t checkpoint; // Next minute of the day the clock is saved
+
+// Defaults, replaced by the newest valid record in EEPROM.
+// Feedings are sorted by schedule_init(), windows must not overlap.
+config_t config = {
+	CONFIG_VERSION, 0, 1,
+	{ FEEDING(SET_HOUR, SET_MINUTE, TIME_WINDOW, ROT * 4) },
+	MOTOR_CRUISE_US, 0
+};
+
+void initMotor(void)
 {
-	DDRB &= ~(1 << BUTTON);
+	motor_init(); // only M0..M3 become outputs
 }
 
-uint16_t globalTime(uint8_t hours, uint8_t minutes)
+uint8_t buttonPressed(void)
 {
-	return hours*HOUR + minutes;
+	button_event_t event;
+	uint8_t pressed = 0;
+	
+	while(button_event(&event))
+	{
+		if(event.type == BUTTON_PRESS) pressed = 1;
+	}
+	return pressed;
 }
 
 void hoursMinutes(uint16_t current, uint8_t *hours, uint8_t *minutes)
@@ -50,131 +102,388 @@ void hoursMinutes(uint16_t current, uint8_t *hours, uint8_t *minutes)
 	*minutes = current % HOUR;
 }
 
-void rotate(uint8_t direction)
-{	
-	uint16_t i;
-	for(i = 0; i < ROT; i++)
+// "source" is LOG_BUTTON, LOG_TIMEOUT or LOG_MANUAL
+uint8_t startFeeding(uint16_t steps, uint8_t source)
+{
+	if(feed_state != FEED_IDLE || steps == 0) return 0;
+	log_add(source, steps);
+	feed_steps = steps;
+	motor_move_mode(LEFT, feed_steps, STEP_MODE);
+	feed_state = FEED_LEFT;
+	return 1;
+}
+
+void updateFeeding(void)
+{
+	if(motor_busy()) return;
+	
+	if(feed_state == FEED_LEFT)
 	{
-		if(direction == RIGHT)
-		{
-			PORTB = M0;	_delay_us(MDELAY);
-			PORTB = M1; _delay_us(MDELAY);
-			PORTB = M2; _delay_us(MDELAY);
-			PORTB = M3;	_delay_us(MDELAY);
-		}
-		else
+		motor_move_mode(RIGHT, feed_steps, STEP_MODE);
+		feed_state = FEED_RIGHT;
+	}
+	else if(feed_state == FEED_RIGHT)
+	{
+		feed_state = FEED_IDLE; // Coils are released after the hold
+	}
+}
+
+// Lowest clock for waiting on the EEPROM, back to CLOCK_BASE afterwards. Only
+// with the crystal RTC and the motor released: the 1 kHz tick and the Timer1
+// ISRs would be late at 125 kHz. The USART cannot run at 9600 baud there.
+void clockSlow(void)
+{
+	#if defined RTC_CRYSTAL && !defined CONSOLE
+	if(motor_power() == MOTOR_RELEASED) clock_set(CLOCK_SLOW);
+	#endif
+}
+
+// Count down to "target" (minute of the day) from the current time, toScreen()
+// blanks it when there is no feeding
+void setCountdown(uint16_t target)
+{
+	uint8_t hours, minutes, seconds, hours_left, minutes_left, seconds_left = 0;
+	uint16_t left_time;
+	
+	if(target == SCHEDULE_NONE)
+	{
+		rtc_countdown_set(0, 0, 0);
+		return;
+	}
+	
+	rtc_get(&hours, &minutes, &seconds);
+	seconds = (seconds >> 4) * 10 + (seconds & 0x0F);
+	
+	left_time = schedule_wrap(target - rtc_day_minute());
+	if(seconds)
+	{
+		left_time = schedule_wrap(left_time - 1);
+		seconds_left = 60 - seconds;
+	}
+	
+	hoursMinutes(left_time, &hours_left, &minutes_left);
+	rtc_countdown_set(hours_left, minutes_left, seconds_left);
+}
+
+// After a change of the clock or the feedings
+void reschedule(void)
+{
+	schedule_init(config.feedings, config.count, rtc_day_minute());
+	setCountdown(schedule_next_minute());
+}
+
+// Clock checkpoint, with the used flag of an open window: a resume from it
+// must not feed that window again
+void saveClock(uint16_t minute)
+{
+	if(schedule_used && schedule_phase != SCHEDULE_CLOSED) minute |= CONFIG_CLOCK_USED;
+	config_save_clock(minute);
+	checkpoint = schedule_wrap((minute & ~CONFIG_CLOCK_USED) + CHECKPOINT_MINUTES);
+}
+
+#ifdef CONSOLE
+uint8_t console_listing = SCHEDULE_MAX; // Next feeding "status" prints
+
+void printTime(uint16_t minute)
+{
+	uint8_t hours, minutes;
+	
+	hoursMinutes(minute, &hours, &minutes);
+	console_number(hours, 2);
+	console_putc(':');
+	console_number(minutes, 2);
+}
+
+void printFeeding(uint8_t index)
+{
+	feeding_t *feeding = &config.feedings[index];
+	
+	console_number(index, 1);
+	console_putc(' ');
+	printTime(feeding->minute);
+	console_putc(' ');
+	console_number(feeding->window, 0);
+	console_putc(' ');
+	console_number(feeding->steps, 0);
+	console_newline();
+}
+
+void printStatus(void)
+{
+	uint8_t hours, minutes, seconds;
+	
+	rtc_get(&hours, &minutes, &seconds);
+	console_number((hours >> 4) * 10 + (hours & 0x0F), 2);
+	console_putc(':');
+	console_number((minutes >> 4) * 10 + (minutes & 0x0F), 2);
+	console_putc(':');
+	console_number((seconds >> 4) * 10 + (seconds & 0x0F), 2);
+	console_puts_P(PSTR(" next "));
+	if(schedule_count) printTime(schedule_next_minute());
+	else console_puts_P(PSTR("--:--"));
+	console_puts_P(feed_state == FEED_IDLE ? PSTR(" idle") : PSTR(" feeding"));
+	console_newline();
+	console_listing = 0; // The feedings follow, one per loop pass
+}
+
+// The schedule changed: sort it, save it and log it
+void scheduleChanged(void)
+{
+	reschedule();
+	config_save(&config);
+	log_add(LOG_SET, config.count);
+}
+
+// Windows must not overlap (schedule.h): "window" at "minute" for feeding
+// "index" has to close before the next one opens, and open after the last one
+uint8_t windowFits(uint8_t index, uint16_t minute, uint8_t window)
+{
+	uint8_t i;
+	uint16_t gap;
+	
+	for(i = 0; i < config.count; i++)
+	{
+		if(i == index) continue;
+		gap = window + config.feedings[i].window - 1;
+		if(schedule_wrap(config.feedings[i].minute - minute) < gap) return 0;
+		if(schedule_wrap(minute - config.feedings[i].minute) < gap) return 0;
+	}
+	return 1;
+}
+
+// Parses one line in place, returns 0 if it is not a valid command. The first
+// word picks the command, anything wrong after it fails the whole line.
+uint8_t consoleCommand(void)
+{
+	uint8_t hours, minutes, seconds, i;
+	uint16_t index, window, steps;
+	
+	if(console_word(PSTR("status")))
+	{
+		if(!console_end()) return 0;
+		printStatus();
+		return 1;
+	}
+	if(console_word(PSTR("time")))
+	{
+		if(!console_read_time(&hours, &minutes, &seconds) || !console_end()) return 0;
+		
+		// A reference time, send it at the start of its second
+		#ifndef RTC_CRYSTAL
+		if(rtc_sync(hours, minutes, seconds)) config_save_trim(rtc_get_trim());
+		#else
+		rtc_sync(hours, minutes, seconds);
+		#endif
+		reschedule();
+		saveClock(rtc_day_minute());
+		log_add(LOG_SET, config.count);
+		return 1;
+	}
+	if(console_word(PSTR("feed")))
+	{
+		steps = ROT * 4;
+		if(!console_end() && (!console_read_number(&steps) || !console_end())) return 0;
+		if(!startFeeding(steps, LOG_MANUAL)) console_puts_P(PSTR("busy\r\n"));
+		return 1;
+	}
+	if(console_word(PSTR("set")))
+	{
+		// set N HH:MM WINDOW STEPS, N == count adds a feeding
+		if(!console_read_number(&index) || index > config.count || index >= SCHEDULE_MAX) return 0;
+		if(!console_read_time(&hours, &minutes, &seconds) || seconds) return 0;
+		if(!console_read_number(&window) || window == 0 || window > 255) return 0;
+		if(!console_read_number(&steps) || steps == 0 || !console_end()) return 0;
+		if(!windowFits(index, hours * HOUR + minutes, window))
 		{
-			PORTB = M3;	_delay_us(MDELAY);
-			PORTB = M2;	_delay_us(MDELAY);
-			PORTB = M1;	_delay_us(MDELAY);
-			PORTB = M0;	_delay_us(MDELAY);
+			console_puts_P(PSTR("overlap\r\n"));
+			return 0;
 		}
+		
+		config.feedings[index].minute = hours * HOUR + minutes;
+		config.feedings[index].window = window;
+		config.feedings[index].steps = steps;
+		if(index == config.count) config.count++;
+		scheduleChanged();
+		return 1;
+	}
+	if(console_word(PSTR("del")))
+	{
+		if(!console_read_number(&index) || index >= config.count || !console_end()) return 0;
+		
+		for(i = index; i + 1 < config.count; i++) config.feedings[i] = config.feedings[i + 1];
+		config.count--;
+		scheduleChanged();
+		return 1;
+	}
+	if(console_word(PSTR("log")))
+	{
+		if(!console_end()) return 0;
+		log_export_start();
+		return 1;
+	}
+	return 0;
+}
+
+// Never waits: long outputs go out a piece per call, as the TX ring drains
+void consolePoll(void)
+{
+	char c;
+	
+	while(console_room() && log_export_char(&c)) console_putc(c);
+	
+	if(console_listing < config.count)
+	{
+		if(console_room() >= 20) printFeeding(console_listing++);
+		return;
 	}
+	if(log_exporting() || !console_line()) return;
+	
+	console_puts_P(consoleCommand() ? PSTR("ok\r\n") : PSTR("?\r\n"));
+	console_next_line();
 }
+#endif // CONSOLE
 
+// Building the frame and the LCDFlush() compare (the toScreen case of make
+// bench), for the host simulation. An estimate until bench numbers exist.
+#define TO_SCREEN_CYCLES 1800
+
+// All values are packed BCD
 void toScreen(uint8_t hours, uint8_t minutes, uint8_t seconds,
 	uint8_t hours_left, uint8_t minutes_left, uint8_t seconds_left)
 {
-	LCDGotoXY(1, 1);
-	LCDWriteString("Current:");
-	LCDWriteInt(hours, 2);
-	LCDWriteString(":");
-	LCDWriteInt(minutes, 2);
-	LCDWriteString(":");
-	LCDWriteInt(seconds, 2);
+	LCDFrameGotoXY(1, 1);
+	LCDFrameWriteFormat_P(PSTR("Current:%b:%b:%b"), hours, minutes, seconds);
+	
+	LCDFrameGotoXY(2, 2);
+	if(schedule_count) LCDFrameWriteFormat_P(PSTR("Left: %b:%b:%b"), hours_left, minutes_left, seconds_left);
+	else LCDFrameWriteString_P(PSTR("Left: --:--:--"));
 	
-	LCDGotoXY(2, 2);
-	LCDWriteString("Left: ");
-	LCDWriteInt(hours_left, 2);
-	LCDWriteString(":");
-	LCDWriteInt(minutes_left, 2);
-	LCDWriteString(":");
-	LCDWriteInt(seconds_left, 2);
+	LCDFlush(); // only the digits that changed go to the LCD
+	HAL_WORK(TO_SCREEN_CYCLES);
 }
 
 int main(void)
 {	
-	uint8_t i;
 	initMotor();
-	initButton();
-	
-	uint8_t hours = START_HOUR, minutes = START_MINUTE, seconds = 0;
-    uint8_t hours_left, minutes_left, seconds_left = 60;
-    
-    uint16_t current_time, set_time, left_time;
-    
-    current_time = globalTime(hours, minutes);
-    set_time = globalTime(SET_HOUR, SET_MINUTE);
-    
-    if(set_time >= current_time){left_time = set_time - current_time;}
-	else{left_time = (set_time + 24*HOUR) - current_time;}
-	hoursMinutes(left_time, &hours_left, &minutes_left);
-
-    LCDSetup(LCD_CURSOR_ULINE);
+	
+	uint8_t hours, minutes, seconds;
+	uint8_t hours_left, minutes_left, seconds_left;
+	uint16_t current_time, steps;
+	uint8_t awake, fast, used = 0;
+	#ifdef RTC_CRYSTAL
+	uint8_t tuning = 128; // Boot time OSCCAL steps left
+	#else
+	int16_t trim;
+	#endif
+	uint8_t reset_flags = MCUSR;
+	
+	MCUSR = 0;
+	config_load(&config);
+	motor_set_cruise_us(config.cruise_us);
+	
+	// Resume from the last clock checkpoint after a power cut
+	if(config_load_clock(&current_time))
+	{
+		used = (current_time & CONFIG_CLOCK_USED) != 0;
+		current_time &= ~CONFIG_CLOCK_USED;
+		hoursMinutes(current_time, &hours, &minutes);
+		rtc_init(hours, minutes, 0);
+	}
+	else
+	{
+		rtc_init(START_HOUR, START_MINUTE, 0);
+	}
+	checkpoint = schedule_wrap(rtc_day_minute() + CHECKPOINT_MINUTES);
+	#ifndef RTC_CRYSTAL
+	if(config_load_trim(&trim)) rtc_set_trim(trim);
+	#endif
+	
+	log_init();
+	log_add(LOG_BOOT, reset_flags);
+	
+	reschedule();
+	if(used) schedule_mark_used(); // fed before the power cut
+	button_init();
+	#ifdef CONSOLE
+	console_init();
+	#endif
+	sei();
+	
+	// Returns at once, the RTC tick resets the LCD while the loop runs
+	LCDSetup(LCD_CURSOR_ULINE);
  
-    while(1)
-    {
-		for(i = 0; i < 100; i++)
+	while(1)
+	{
+		current_time = rtc_day_minute();
+		
+		if(current_time == schedule_deadline)
 		{
-			if((current_time > set_time - TIME_WINDOW) & (current_time < set_time + TIME_WINDOW))
-			{
-				if(PIN & (1 << BUTTON) & (USED == 0))
-				{
-					rotate(LEFT);
-					rotate(RIGHT);
-					
-					PORTB &= (1 << BUTTON);
-					seconds += 2;
-					USED = 1;
-					break;
-				}
-			}
-			else if((current_time == set_time + TIME_WINDOW) & (seconds == 0) & (USED == 0))
-			{
-				rotate(LEFT);
-				rotate(RIGHT);
-				
-				PORTB &= (1 << BUTTON);
-				seconds += 2;
-				break;
-			}
-			else if(USED == 1)
-			{
-				USED = 0;
-			}
-			_delay_ms(9);
-			_delay_us(878);
+			// non zero if a window timed out, a resume must not repeat it
+			if(startFeeding(schedule_event(), LOG_TIMEOUT)) saveClock(current_time);
+			setCountdown(schedule_next_minute());
 		}
 		
-		if(seconds < 60)
-		{				
-			seconds += 1;
-			seconds_left -= 1;
+		if(current_time == checkpoint)
+		{
+			clockSlow(); // The EEPROM writes are busy waits
+			saveClock(current_time);
+			clock_set(CLOCK_BASE);
 		}
-		else
+		
+		if(buttonPressed())
 		{
-			seconds = 0;
-			seconds_left = 60;
-			
-			minutes += 1;
-			if(minutes > 59)
+			steps = schedule_press();
+			if(steps)
 			{
-				hours += 1;
-				minutes -= 60;
-			}
-			if(hours > 24)
-			{
-				hours -= 24;
+				if(startFeeding(steps, LOG_BUTTON)) saveClock(current_time);
 			}
+			else log_add(LOG_DROPPED, 0); // outside a window, or already fed
+		}
+		updateFeeding();
+		
+		#ifdef RTC_CRYSTAL
+		// Bring the CPU clock to F_CPU, a step per pass so the button and the
+		// clock are served from the start. Timer1 must be free.
+		if(tuning && motor_power() == MOTOR_RELEASED) tuning = rtc_tune_cpu() ? tuning - 1 : 0;
+		#endif
+		
+		log_poll();
+		#ifdef CONSOLE
+		consolePoll();
+		#endif
+		
+		if(rtc_second_flag)
+		{
+			rtc_second_flag = 0;
 			
-			current_time = globalTime(hours, minutes);
-			if(set_time >= current_time){left_time = set_time - current_time;}
-			else{left_time = (set_time + 24*HOUR) - current_time;}
+			// The frame diff is the longest piece of CPU work, do it fast
+			clock_set(CLOCK_FAST);
+			rtc_get(&hours, &minutes, &seconds);
+			rtc_countdown_get(&hours_left, &minutes_left, &seconds_left);
+			toScreen(hours, minutes, seconds, hours_left, minutes_left, seconds_left);
+			clock_set(CLOCK_BASE);
 			
-			hoursMinutes(left_time, &hours_left, &minutes_left);
+			#ifdef RTC_CRYSTAL
+			// Follow the RC oscillator's temperature drift, Timer1 must be free
+			if(seconds == 0 && motor_power() == MOTOR_RELEASED) rtc_tune_cpu();
+			#endif
 		}
 		
-		toScreen(hours, minutes, seconds, hours_left, minutes_left, seconds_left);
-    }
-    return 0;
+		// Sleep until the next tick, button, LCD byte or console byte.
+		// Timer1 and the USART stop in power-save, so stay in idle while
+		// the motor is powered, the log is busy or the console is in use.
+		awake = motor_power() != MOTOR_RELEASED || log_busy();
+		#ifdef CONSOLE
+		awake = 1;
+		#endif
+		fast = LCDQueuePending() || button_busy() || log_busy();
+		#ifdef RTC_CRYSTAL
+		if(tuning) fast = 1; // Wake for the next step soon
+		#endif
+		rtc_fast_ticks(fast);
+		if(awake) clockSlow(); // Idle draws less at a slower clock
+		rtc_sleep(awake ? SLEEP_MODE_IDLE : SLEEP_MODE_PWR_SAVE);
+		clock_set(CLOCK_BASE);
+	}
+	return 0;
 }
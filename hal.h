@@ -0,0 +1,54 @@
+/*_______________________________________________________________________________
+hal.h - Hardware abstraction between the firmware and the host simulation
+
+On the AVR the avr-libc headers are the hardware layer and everything here
+compiles to nothing. With SIM defined (make sim) the same sources are built
+for Linux: sim/ supplies avr/io.h, avr/interrupt.h, util/delay.h and friends,
+where PORTB, PINB, the timers and the USART are objects backed by device
+models in sim/sim.cpp, and time only exists as virtual time.
+
+The few things the register level cannot tell the simulator go through the
+macros below.
+
+HOW TO USE
+----------
+- Include this file first in the application, before any module.
+- HAL_WAIT() in the body of a busy wait loop, e.g.
+	while(motor_busy()) HAL_WAIT();
+  On the host it lets virtual time run to the next interrupt.
+- HAL_POLL() in a loop that polls a register with interrupts off. On the
+  host it lets a few CPU cycles pass.
+- HAL_WORK(cycles) after a long piece of CPU work. On the host, code takes
+  no time: this lets "cycles" CPU cycles pass at the current clock, so the
+  run and its energy budget see the work.
+- HAL_LCD_WIRING(data_start, rs, rw, e) and HAL_MOTOR_WIRING(m0, m1, m2, m3)
+  tell the simulator where the LCD and coils are. OnLCDLib.h and motor.h call
+  them from their setup functions.
+__________________________________________________________________________________*/
+
+#ifndef HAL_H
+#define HAL_H
+
+#ifdef SIM
+
+#include "sim.h"
+
+#define HAL_WAIT() sim_wait()
+#define HAL_POLL() sim_cycles(4)
+#define HAL_WORK(cycles) sim_cycles(cycles)
+#define HAL_LCD_WIRING(data_start, rs, rw, e) sim_lcd_wiring(data_start, rs, rw, e)
+#define HAL_MOTOR_WIRING(m0, m1, m2, m3) sim_motor_wiring(m0, m1, m2, m3)
+
+#define main sim_main // The simulator owns the process entry point
+
+#else
+
+#define HAL_WAIT()
+#define HAL_POLL()
+#define HAL_WORK(cycles)
+#define HAL_LCD_WIRING(data_start, rs, rw, e)
+#define HAL_MOTOR_WIRING(m0, m1, m2, m3)
+
+#endif // SIM
+
+#endif // HAL_H
@@ -0,0 +1,398 @@
+/*_______________________________________________________________________________
+log.h - Feed event log in EEPROM, streamed out as text
+
+Every feeding, dropped press and boot is appended to a ring of 3 byte entries
+in the EEPROM space left free by config.h. Entries are bit packed:
+
+	byte 0	lap (1) | type (3) | minutes (4 high bits)
+	byte 1	minutes (7 low bits) | value (1 high bit)
+	byte 2	value (8 low bits)
+
+"minutes" is the time since the previous entry (delta), except for LOG_BOOT,
+LOG_SET and LOG_TIME anchor entries which hold a minute of the day and anchor
+the deltas. A LOG_TIME anchor (the time of the entry before it) is put in
+every 16th slot, so a ring that wrapped over its oldest boot entry can still
+be placed in time. "value" is the portion in units of 4 steps for feedings,
+the reset flags (MCUSR) for LOG_BOOT and the number of feedings for LOG_SET.
+
+Deltas are taken from rtc_uptime, which does not wrap at midnight, so days
+without an entry are kept. A delta over the 11 bit field (2047 minutes) goes
+into a LOG_TIME gap entry before the event, with the minutes above 2047 in
+"value" (never 0, which tells it from an anchor), and the event gets a delta
+of 0. Anchors and gaps are not exported.
+
+The lap bit flips each time the ring wraps; at boot the first slot whose lap
+bit differs from slot 0 (or which is still erased) is the head. Byte 0 is
+written last, so an entry torn by a power cut is never taken for a new one.
+
+log_add() only queues the entry in RAM. log_poll() writes one byte when the
+EEPROM is ready and returns at once, so the main loop never waits the 3.3 ms
+of an EEPROM write. Retention is 233 entries: with one feeding a day and a
+few boots that is more than two months, with four feedings a day six weeks.
+
+EXPORT
+------
+The log is read back oldest first as text lines, one character at a time:
+
+	d003 12:00 timeout 512
+	d004 11:48 button 512
+
+"dNNN" counts days from the start of the export. Entries older than the
+first anchor in the ring show as "d--- --:--".
+
+HOW TO USE
+----------
+- Include rtc.h and config.h first (for rtc_day_minute(), rtc_get_uptime()
+  and CONFIG_FREE_START)
+- log_init() once at boot, before the first log_add()
+- log_add(type, value) to record an event, log_poll() on every main loop
+  pass. log_busy() is set while bytes are waiting or an export runs.
+- log_export_start(), then log_export_char(&c) returns 1 with the next
+  character while log_exporting() is set. It returns 0 (try again later)
+  while the EEPROM is busy.
+- The console "log" command (console.h) sends the export over the USART.
+__________________________________________________________________________________*/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+#define LOG_BOOT 0 // minutes: minute of the day, value: MCUSR
+#define LOG_BUTTON 1 // Fed on a button press, value: steps
+#define LOG_TIMEOUT 2 // Fed when the window timed out, value: steps
+#define LOG_DROPPED 3 // Button pressed outside a feeding window
+#define LOG_MANUAL 4 // Fed from the console, value: steps
+#define LOG_TIME 5 // value 0: anchor, minutes: minute of the day of the previous entry,
+                   // else a gap of value * 2048 + minutes since the previous entry
+#define LOG_SET 6 // Clock or schedule changed, minutes: minute of the day
+#define LOG_ERASED 7 // Never written
+
+#define LOG_START CONFIG_FREE_START
+#define LOG_ENTRY_SIZE 3
+#define LOG_SLOTS ((CONFIG_FREE_END - LOG_START) / LOG_ENTRY_SIZE)
+#define LOG_ANCHOR_EVERY 16 // power of 2
+#define LOG_STEP_SHIFT 2 // value = steps >> 2, up to 2044 steps
+#define LOG_VALUE_MAX 0x1FF
+#define LOG_DELTA_BITS 11
+#define LOG_DELTA_MAX ((1 << LOG_DELTA_BITS) - 1)
+#define LOG_GAP_MAX (((uint32_t)LOG_VALUE_MAX << LOG_DELTA_BITS) | LOG_DELTA_MAX) // 2 years
+#define LOG_PENDING 4 // power of 2
+#define LOG_LINE_SIZE 28
+
+typedef struct
+{
+	uint8_t slot;
+	uint8_t bytes[LOG_ENTRY_SIZE];
+} log_entry_t;
+
+log_entry_t log_pending[LOG_PENDING];
+uint8_t log_pending_head = 0, log_pending_tail = 0;
+uint8_t log_pending_byte = 0; // Bytes of the tail entry already written
+uint8_t log_next = 0; // Slot of the next log_add()
+uint8_t log_lap = 0;
+uint8_t log_head = 0; // Slot after the newest entry in EEPROM
+uint16_t log_last_minute = 0;
+uint32_t log_last_uptime = 0;
+uint8_t log_lost = 0; // Entries dropped because the RAM queue was full
+
+// Export state
+uint8_t log_export_slot = 0, log_export_left = 0;
+uint8_t log_export_known = 0, log_export_first = 0;
+uint16_t log_export_minute = 0, log_export_day = 0;
+char log_line[LOG_LINE_SIZE];
+uint8_t log_line_pos = 0, log_line_len = 0;
+
+static const char log_names[][8] PROGMEM = {
+	"boot", "button", "timeout", "dropped", "manual", "time", "set", "?"
+};
+
+// Bytes 1 and 2 are written before byte 0, which commits the entry
+static const uint8_t log_write_order[LOG_ENTRY_SIZE] = {1, 2, 0};
+
+static uint8_t *log_address(uint8_t slot, uint8_t byte)
+{
+	return (uint8_t *)(uintptr_t)(LOG_START + slot * LOG_ENTRY_SIZE + byte);
+}
+
+static uint8_t log_type(uint8_t byte0)
+{
+	return (byte0 >> 4) & 0x07;
+}
+
+void log_init(void)
+{
+	uint8_t first = eeprom_read_byte(log_address(0, 0));
+	uint8_t i, byte0;
+
+	log_next = 0;
+	log_lap = 0;
+	if(log_type(first) != LOG_ERASED)
+	{
+		log_lap = first >> 7;
+		for(i = 1; i < LOG_SLOTS; i++)
+		{
+			byte0 = eeprom_read_byte(log_address(i, 0));
+			if(log_type(byte0) == LOG_ERASED || (byte0 >> 7) != log_lap) break;
+		}
+		if(i < LOG_SLOTS) log_next = i;
+		else log_lap ^= 1; // Every slot is in this lap, the next write wraps
+	}
+	log_head = log_next;
+}
+
+static void log_push(uint8_t type, uint16_t minutes, uint16_t value, uint16_t now, uint32_t uptime)
+{
+	uint8_t next = (log_pending_head + 1) & (LOG_PENDING - 1);
+	log_entry_t *entry = &log_pending[log_pending_head];
+
+	if(next == log_pending_tail)
+	{
+		if(log_lost < 0xFF) log_lost++;
+		return;
+	}
+
+	if(value > LOG_VALUE_MAX) value = LOG_VALUE_MAX;
+	entry->slot = log_next;
+	entry->bytes[0] = (log_lap << 7) | (type << 4) | (minutes >> 7);
+	entry->bytes[1] = (minutes << 1) | (value >> 8);
+	entry->bytes[2] = value;
+	log_pending_head = next;
+
+	log_last_minute = now;
+	log_last_uptime = uptime;
+	if(++log_next >= LOG_SLOTS)
+	{
+		log_next = 0;
+		log_lap ^= 1;
+	}
+}
+
+// An entry with a delta, after an anchor if its slot takes one
+static void log_push_delta(uint8_t type, uint16_t minutes, uint16_t value, uint16_t now, uint32_t uptime)
+{
+	// The anchor holds the time of the previous entry, so the deltas on
+	// both sides of it stay intact
+	if((log_next & (LOG_ANCHOR_EVERY - 1)) == 0)
+	{
+		log_push(LOG_TIME, log_last_minute, 0, log_last_minute, log_last_uptime);
+	}
+	log_push(type, minutes, value, now, uptime);
+}
+
+void log_add(uint8_t type, uint16_t value)
+{
+	uint16_t now = rtc_day_minute();
+	uint32_t uptime = rtc_get_uptime();
+	uint32_t delta = (uptime - log_last_uptime) / 60;
+	int16_t offset;
+
+	if(type == LOG_BOOT || type == LOG_SET)
+	{
+		log_push(type, now, value, now, uptime);
+		return;
+	}
+
+	// The uptime does not start on a full minute: round the delta so that it
+	// ends on "now" (this also takes up a small rtc_sync() step)
+	offset = now - (uint16_t)((log_last_minute + delta) % (24 * 60));
+	if(offset >= 12 * 60) offset -= 24 * 60;
+	if(offset < -12 * 60) offset += 24 * 60;
+	if(offset < 0 && (uint32_t)-offset > delta) delta = 0;
+	else delta += offset;
+
+	if(type == LOG_BUTTON || type == LOG_TIMEOUT || type == LOG_MANUAL) value >>= LOG_STEP_SHIFT;
+	if(delta > LOG_DELTA_MAX)
+	{
+		if(delta > LOG_GAP_MAX) delta = LOG_GAP_MAX;
+		log_push_delta(LOG_TIME, delta & LOG_DELTA_MAX, delta >> LOG_DELTA_BITS, now, uptime);
+		delta = 0;
+	}
+	log_push_delta(type, delta, value, now, uptime);
+}
+
+// Writes at most one byte, never waits for the EEPROM
+void log_poll(void)
+{
+	log_entry_t *entry = &log_pending[log_pending_tail];
+	uint8_t byte;
+
+	if(log_pending_tail == log_pending_head || !eeprom_is_ready()) return;
+
+	byte = log_write_order[log_pending_byte];
+	eeprom_update_byte(log_address(entry->slot, byte), entry->bytes[byte]);
+	if(++log_pending_byte < LOG_ENTRY_SIZE) return;
+
+	log_pending_byte = 0;
+	log_head = entry->slot + 1;
+	if(log_head >= LOG_SLOTS) log_head = 0;
+	log_pending_tail = (log_pending_tail + 1) & (LOG_PENDING - 1);
+}
+
+uint8_t log_exporting(void)
+{
+	return log_export_left || log_line_pos < log_line_len;
+}
+
+uint8_t log_busy(void)
+{
+	return log_pending_tail != log_pending_head || log_exporting();
+}
+
+static void log_read(uint8_t slot, uint8_t *type, uint16_t *minutes, uint16_t *value)
+{
+	uint8_t bytes[LOG_ENTRY_SIZE];
+
+	eeprom_read_block(bytes, log_address(slot, 0), LOG_ENTRY_SIZE);
+	*type = log_type(bytes[0]);
+	*minutes = ((uint16_t)(bytes[0] & 0x0F) << 7) | (bytes[1] >> 1);
+	*value = ((uint16_t)(bytes[1] & 0x01) << 8) | bytes[2];
+}
+
+// Minutes since the previous entry, for anything but a boot, set or anchor
+static uint32_t log_delta(uint8_t type, uint16_t minutes, uint16_t value)
+{
+	if(type == LOG_TIME) return ((uint32_t)value << LOG_DELTA_BITS) | minutes; // Gap
+	return minutes;
+}
+
+static uint8_t log_slot_after(uint8_t slot)
+{
+	return slot + 1 < LOG_SLOTS ? slot + 1 : 0;
+}
+
+void log_export_start(void)
+{
+	uint8_t slot, left, type;
+	uint16_t minutes, value, sum = 0;
+
+	// Oldest entry: the head slot if the ring wrapped, slot 0 otherwise
+	log_read(log_head, &type, &minutes, &value);
+	if(type != LOG_ERASED)
+	{
+		log_export_slot = log_head;
+		log_export_left = LOG_SLOTS;
+	}
+	else
+	{
+		log_export_slot = 0;
+		log_export_left = log_head;
+	}
+
+	log_export_known = 0;
+	log_export_first = 1;
+	log_export_day = 0;
+	log_line_pos = log_line_len = 0;
+
+	// Place the entries before the first anchor by walking back from it.
+	// Not across a boot or a clock change, the time jumped there.
+	slot = log_export_slot;
+	for(left = log_export_left; left && left + LOG_ANCHOR_EVERY > log_export_left; left--)
+	{
+		log_read(slot, &type, &minutes, &value);
+		if(type == LOG_BOOT || type == LOG_SET) break;
+		if(type == LOG_TIME && !value && left != log_export_left)
+		{
+			log_export_minute = minutes >= sum ? minutes - sum : minutes + 24 * 60 - sum;
+			log_export_known = 1;
+			break;
+		}
+		if(left != log_export_left) sum = (sum + log_delta(type, minutes, value)) % (24 * 60);
+		slot = log_slot_after(slot);
+	}
+}
+
+static uint8_t log_put_number(uint8_t pos, uint16_t number, uint8_t digits)
+{
+	static const uint16_t powers[] = {1, 10, 100, 1000, 10000};
+	uint8_t digit;
+
+	while(digits--)
+	{
+		for(digit = '0'; number >= powers[digits]; digit++) number -= powers[digits];
+		log_line[pos++] = digit;
+	}
+	return pos;
+}
+
+static uint8_t log_put_string_P(uint8_t pos, const char *string)
+{
+	char c;
+
+	while((c = pgm_read_byte(string++))) log_line[pos++] = c;
+	return pos;
+}
+
+// Format the next entry into log_line
+static void log_export_line(void)
+{
+	uint8_t type, pos;
+	uint16_t minutes, value;
+
+	log_read(log_export_slot, &type, &minutes, &value);
+	log_export_slot = log_slot_after(log_export_slot);
+	log_export_left--;
+
+	if(type == LOG_BOOT || type == LOG_SET || (type == LOG_TIME && !value))
+	{
+		if(log_export_known && minutes < log_export_minute) log_export_day++;
+		log_export_minute = minutes;
+		log_export_known = 1;
+	}
+	else if(log_export_known && !log_export_first)
+	{
+		uint32_t delta = log_delta(type, minutes, value);
+		log_export_day += delta / (24 * 60);
+		log_export_minute += delta % (24 * 60);
+		if(log_export_minute >= 24 * 60)
+		{
+			log_export_minute -= 24 * 60;
+			log_export_day++;
+		}
+	}
+	log_export_first = 0;
+
+	log_line_pos = log_line_len = 0;
+	if(type == LOG_TIME) return; // Anchors and gaps are not shown
+
+	pos = 0;
+	log_line[pos++] = 'd';
+	if(log_export_known)
+	{
+		pos = log_put_number(pos, log_export_day, 3);
+		log_line[pos++] = ' ';
+		pos = log_put_number(pos, log_export_minute / 60, 2);
+		log_line[pos++] = ':';
+		pos = log_put_number(pos, log_export_minute % 60, 2);
+	}
+	else
+	{
+		pos = log_put_string_P(pos, PSTR("--- --:--"));
+	}
+	log_line[pos++] = ' ';
+	pos = log_put_string_P(pos, log_names[type]);
+	if(type != LOG_DROPPED)
+	{
+		log_line[pos++] = ' ';
+		if(type == LOG_BUTTON || type == LOG_TIMEOUT || type == LOG_MANUAL) value <<= LOG_STEP_SHIFT;
+		pos = log_put_number(pos, value, value < 10 ? 1 : value < 100 ? 2 : value < 1000 ? 3 : 4);
+	}
+	log_line[pos++] = '\r';
+	log_line[pos++] = '\n';
+	log_line_len = pos;
+}
+
+uint8_t log_export_char(char *c)
+{
+	while(log_line_pos >= log_line_len)
+	{
+		if(!log_export_left || !eeprom_is_ready()) return 0;
+		log_export_line();
+	}
+	*c = log_line[log_line_pos++];
+	return 1;
+}
+
+#endif // LOG_H
@@ -0,0 +1,336 @@
+/*_______________________________________________________________________________
+motor.h - Interrupt driven stepper engine
+
+Timer1 runs in CTC mode and fires TIMER1_COMPA once per step. The ISR walks a
+phase table and writes the next coil pattern to the M0..M3 pins, so a move runs
+in the background while the main loop keeps servicing the clock, LCD and button.
+
+Moves follow a trapezoidal speed profile: they start at the stall safe rate
+(MDELAY), accelerate at MOTOR_ACCEL up to the cruise rate (MOTOR_CRUISE_US) and
+decelerate symmetrically before the last step. Moves too short to reach cruise
+speed become triangular. The ramp intervals are computed by the compiler and
+stored in flash, the ISR only looks them up.
+
+Coil patterns come from one half step table. Wave drive (one coil) uses the
+even entries, two phase full step (two coils, more torque) the odd entries and
+half step all of them. Direction only changes the sign of the table stride.
+
+POWER STATES
+------------
+	MOTOR_ACTIVE	a move is running, coils at full current
+	MOTOR_HOLD		after a move, the last pattern is chopped by the same
+					Timer1 ISR: on for MOTOR_HOLD_DUTY percent of every
+					MOTOR_CHOP_US period, for MOTOR_HOLD_MS
+	MOTOR_RELEASED	all coils off, Timer1 stopped
+Average current of a 28BYJ-48 at 5 V (about 70 mA per energized coil):
+wave 70 mA and full step 140 mA while active, roughly the duty cycle of that
+while holding (18 / 35 mA at 25 %), nothing when released. The gear train
+holds the feeder, so the hold only lets the rotor settle before letting go.
+Timer1 stops in power-save: keep the CPU in idle until motor_power() is
+MOTOR_RELEASED.
+
+HOW TO USE
+----------
+- Define M0..M3 (coil pin masks on PORTB) before including this file.
+  MDELAY (start step period in microseconds) defaults to 2500,
+  MOTOR_CRUISE_US (cruise step period) to 1500 and MOTOR_ACCEL (steps/s^2)
+  to 2000.
+- Define MOTOR_CLOCK_SELECT if the CPU clock changes at run time (see
+  clock.h).
+- motor_init() once, then sei()
+- motor_move(direction, steps) starts a wave drive move and returns
+  immediately. A direction of 1 steps M0->M1->M2->M3, 0 steps M3->M2->M1->M0.
+- motor_move_mode(direction, steps, mode) does the same with mode set to
+  MOTOR_WAVE, MOTOR_FULL or MOTOR_HALF. In half step mode every step is half
+  as far, so twice the steps cover the same distance.
+- motor_busy() is non zero until the last step period has elapsed.
+- motor_release() switches all coils off now, without waiting for the hold.
+- motor_power() is MOTOR_ACTIVE, MOTOR_HOLD or MOTOR_RELEASED.
+- motor_set_hold_ms(ms) changes the hold after each move (MOTOR_HOLD_MS,
+  default 200). 0 releases the coils as soon as the last step period ends.
+- motor_set_cruise_us(us) changes the cruise step period at run time. It can
+  be slower than MOTOR_CRUISE_US (the ramp then ends earlier) but not faster.
+
+Only the M0..M3 pins are touched. Coil changes are written to the PIN register,
+which toggles just the bits that differ in a single instruction, so other PORTB
+pins (e.g. a button pull-up) keep their state even if the main loop modifies
+them at the same time.
+__________________________________________________________________________________*/
+
+#ifndef MOTOR_H
+#define MOTOR_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "hal.h"
+
+#ifndef MDELAY
+#define MDELAY 2500
+#endif
+#ifndef MOTOR_CRUISE_US
+#define MOTOR_CRUISE_US 1500
+#endif
+#ifndef MOTOR_MAX_US
+#define MOTOR_MAX_US 20000 // Slowest cruise step period motor_set_cruise_us() is given
+#endif
+#define MOTOR_MIN_US MOTOR_CRUISE_US // Fastest, the ramp table ends there
+#ifndef MOTOR_ACCEL
+#define MOTOR_ACCEL 2000
+#endif
+#ifndef MOTOR_HOLD_MS
+#define MOTOR_HOLD_MS 200
+#endif
+#ifndef MOTOR_HOLD_DUTY
+#define MOTOR_HOLD_DUTY 25 // percent
+#endif
+#ifndef MOTOR_CHOP_US
+#define MOTOR_CHOP_US 1000 // Shorter than ~2 L/R of the coil so the current stays smooth
+#endif
+#if MOTOR_HOLD_DUTY < 1 || MOTOR_HOLD_DUTY > 99
+	#error "MOTOR_HOLD_DUTY must be 1..99, use MOTOR_HOLD_MS 0 for no hold"
+#endif
+
+#define MOTOR_PORT PORTB
+#define MOTOR_DDR DDRB
+#define MOTOR_PIN PINB // Writing 1 toggles the PORTB bit
+#define MOTOR_MASK (M0 | M1 | M2 | M3)
+
+// Timer1 clk/8, convert a period in microseconds to compare counts. With a
+// run time CPU clock (clock.h) MOTOR_CLOCK_SELECT picks the prescaler that
+// counts at F_CPU / 8.
+#ifndef MOTOR_CLOCK_SELECT
+#define MOTOR_CLOCK_SELECT (1 << CS11)
+#endif
+#define MOTOR_CLOCK_MASK ((1 << CS12) | (1 << CS11) | (1 << CS10)) // Stops Timer1
+#define MOTOR_US_TO_TICKS(us) ((uint16_t)(((uint32_t)(us) * (F_CPU / 1000)) / 8000) - 1)
+
+// Ramp length from v^2 = v0^2 + 2*a*n
+#define MOTOR_START_RATE (1000000UL / MDELAY)
+#define MOTOR_CRUISE_RATE (1000000UL / MOTOR_CRUISE_US)
+#if MOTOR_CRUISE_US >= MDELAY
+	#define MOTOR_RAMP_STEPS 0
+#else
+	#define MOTOR_RAMP_STEPS ((MOTOR_CRUISE_RATE * MOTOR_CRUISE_RATE \
+		- MOTOR_START_RATE * MOTOR_START_RATE) / (2UL * MOTOR_ACCEL))
+#endif
+#if MOTOR_RAMP_STEPS > 128
+	#error "Ramp longer than 128 steps, raise MOTOR_ACCEL or MOTOR_CRUISE_US"
+#endif
+#define MOTOR_CRUISE_TICKS MOTOR_US_TO_TICKS(MOTOR_CRUISE_US)
+#define MOTOR_CHOP_ON_TICKS MOTOR_US_TO_TICKS(MOTOR_CHOP_US * MOTOR_HOLD_DUTY / 100)
+#define MOTOR_CHOP_OFF_TICKS MOTOR_US_TO_TICKS(MOTOR_CHOP_US * (100 - MOTOR_HOLD_DUTY) / 100)
+#define MOTOR_HOLD_PERIODS(ms) ((uint16_t)((uint32_t)(ms) * 1000 / MOTOR_CHOP_US))
+
+// Interval in timer ticks after the n-th step of a ramp
+#define MOTOR_RAMP_ENTRY(n) (uint16_t)((F_CPU / 8.0) / __builtin_sqrt( \
+	(double)MOTOR_START_RATE * MOTOR_START_RATE + 2.0 * MOTOR_ACCEL * (n)) - 1)
+#define MOTOR_RAMP_BLOCK(b) \
+	MOTOR_RAMP_ENTRY(16*b+0), MOTOR_RAMP_ENTRY(16*b+1), MOTOR_RAMP_ENTRY(16*b+2), MOTOR_RAMP_ENTRY(16*b+3), \
+	MOTOR_RAMP_ENTRY(16*b+4), MOTOR_RAMP_ENTRY(16*b+5), MOTOR_RAMP_ENTRY(16*b+6), MOTOR_RAMP_ENTRY(16*b+7), \
+	MOTOR_RAMP_ENTRY(16*b+8), MOTOR_RAMP_ENTRY(16*b+9), MOTOR_RAMP_ENTRY(16*b+10), MOTOR_RAMP_ENTRY(16*b+11), \
+	MOTOR_RAMP_ENTRY(16*b+12), MOTOR_RAMP_ENTRY(16*b+13), MOTOR_RAMP_ENTRY(16*b+14), MOTOR_RAMP_ENTRY(16*b+15)
+
+// Only the blocks the ramp reaches into are emitted
+static const uint16_t motor_ramp[] PROGMEM = {
+	MOTOR_RAMP_BLOCK(0)
+#if MOTOR_RAMP_STEPS > 16
+	, MOTOR_RAMP_BLOCK(1)
+#endif
+#if MOTOR_RAMP_STEPS > 32
+	, MOTOR_RAMP_BLOCK(2)
+#endif
+#if MOTOR_RAMP_STEPS > 48
+	, MOTOR_RAMP_BLOCK(3)
+#endif
+#if MOTOR_RAMP_STEPS > 64
+	, MOTOR_RAMP_BLOCK(4)
+#endif
+#if MOTOR_RAMP_STEPS > 80
+	, MOTOR_RAMP_BLOCK(5)
+#endif
+#if MOTOR_RAMP_STEPS > 96
+	, MOTOR_RAMP_BLOCK(6)
+#endif
+#if MOTOR_RAMP_STEPS > 112
+	, MOTOR_RAMP_BLOCK(7)
+#endif
+};
+
+#define MOTOR_WAVE 0
+#define MOTOR_FULL 1
+#define MOTOR_HALF 2
+
+#define MOTOR_RELEASED 0
+#define MOTOR_HOLD 1
+#define MOTOR_ACTIVE 2
+
+static const uint8_t motor_phases[8] = {
+	M0, M0 | M1, M1, M1 | M2, M2, M2 | M3, M3, M3 | M0
+};
+
+volatile uint16_t motor_steps_done = 0;
+volatile uint16_t motor_steps_left = 0;
+volatile uint8_t motor_running = 0;
+volatile int8_t motor_stride = 2;
+uint8_t motor_phase = 0;
+uint8_t motor_coils = 0; // Current state of the M0..M3 outputs
+uint16_t motor_cruise_ticks = MOTOR_CRUISE_TICKS;
+volatile uint8_t motor_state = MOTOR_RELEASED;
+uint16_t motor_hold_left = 0; // Chop periods until the coils are released
+uint16_t motor_hold_periods = MOTOR_HOLD_PERIODS(MOTOR_HOLD_MS);
+
+static void motor_step(void)
+{
+	motor_phase = (motor_phase + motor_stride) & 0x07;
+
+	MOTOR_PIN = motor_coils ^ motor_phases[motor_phase];
+	motor_coils = motor_phases[motor_phase];
+	motor_steps_left--;
+
+	// Distance to the nearest end of the move picks the ramp entry
+	uint16_t ramp = motor_steps_done < motor_steps_left ? motor_steps_done : motor_steps_left;
+	motor_steps_done++;
+
+	uint16_t interval = motor_cruise_ticks;
+	if(ramp < MOTOR_RAMP_STEPS && pgm_read_word(&motor_ramp[ramp]) > interval)
+	{
+		interval = pgm_read_word(&motor_ramp[ramp]);
+	}
+	OCR1A = interval;
+}
+
+// One half of a chop period, Timer1 ISR
+static void motor_chop(void)
+{
+	if(motor_coils)
+	{
+		MOTOR_PIN = motor_coils; // Off for the rest of the period
+		motor_coils = 0;
+		OCR1A = MOTOR_CHOP_OFF_TICKS;
+		if(motor_hold_left) return;
+	}
+	if(motor_hold_left == 0)
+	{
+		TCCR1B &= ~MOTOR_CLOCK_MASK;
+		motor_state = MOTOR_RELEASED;
+		return;
+	}
+
+	motor_hold_left--;
+	motor_coils = motor_phases[motor_phase];
+	MOTOR_PIN = motor_coils;
+	OCR1A = MOTOR_CHOP_ON_TICKS;
+}
+
+void motor_init(void)
+{
+	MOTOR_DDR |= MOTOR_MASK;
+	MOTOR_PORT &= ~MOTOR_MASK;
+	motor_coils = 0;
+
+	TCCR1A = 0;
+	TCCR1B = (1 << WGM12); // CTC, TOP = OCR1A, timer stopped
+	OCR1A = pgm_read_word(&motor_ramp[0]);
+	TIMSK1 = (1 << OCIE1A);
+	HAL_MOTOR_WIRING(M0, M1, M2, M3);
+}
+
+void motor_move_mode(uint8_t direction, uint16_t steps, uint8_t mode)
+{
+	int8_t stride = (mode == MOTOR_HALF) ? 1 : 2;
+	if(steps == 0) return;
+
+	TCCR1B &= ~MOTOR_CLOCK_MASK;
+	if(!direction) stride = -stride;
+
+	// Wave lives on even entries, full step on odd ones. When switching,
+	// back up half a step so the first step lands on the right parity.
+	if(mode != MOTOR_HALF && (motor_phase & 1) != mode)
+	{
+		motor_phase = (motor_phase - stride / 2) & 0x07;
+	}
+
+	motor_stride = stride;
+	motor_steps_left = steps;
+	motor_steps_done = 0;
+	motor_running = 1;
+	motor_state = MOTOR_ACTIVE;
+	motor_hold_left = 0;
+
+	motor_step(); // first phase right away, like the old rotate()
+	TCNT1 = 0;
+	TIFR1 = (1 << OCF1A);
+	TCCR1B |= MOTOR_CLOCK_SELECT;
+}
+
+void motor_move(uint8_t direction, uint16_t steps)
+{
+	motor_move_mode(direction, steps, MOTOR_WAVE);
+}
+
+void motor_set_cruise_us(uint16_t us)
+{
+	uint16_t ticks = MOTOR_US_TO_TICKS(us);
+	if(ticks < MOTOR_CRUISE_TICKS) ticks = MOTOR_CRUISE_TICKS; // The ramp table ends there
+
+	uint8_t sreg = SREG;
+	cli();
+	motor_cruise_ticks = ticks;
+	SREG = sreg;
+}
+
+void motor_set_hold_ms(uint16_t ms)
+{
+	uint16_t periods = MOTOR_HOLD_PERIODS(ms);
+
+	uint8_t sreg = SREG;
+	cli();
+	motor_hold_periods = periods;
+	SREG = sreg;
+}
+
+uint8_t motor_busy(void)
+{
+	return motor_running;
+}
+
+uint8_t motor_power(void)
+{
+	return motor_state;
+}
+
+void motor_release(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	MOTOR_PIN = motor_coils;
+	motor_coils = 0;
+	motor_hold_left = 0;
+	if(!motor_running)
+	{
+		TCCR1B &= ~MOTOR_CLOCK_MASK;
+		motor_state = MOTOR_RELEASED;
+	}
+	SREG = sreg;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+	if(motor_steps_left)
+	{
+		motor_step();
+		return;
+	}
+
+	if(motor_running)
+	{
+		// Last step has been held for a full period, chop from here on
+		motor_running = 0;
+		motor_hold_left = motor_hold_periods;
+		motor_state = MOTOR_HOLD;
+	}
+	motor_chop();
+}
+
+#endif // MOTOR_H
@@ -0,0 +1,555 @@
+/*_______________________________________________________________________________
+rtc.h - Interrupt driven real time clock
+
+Timer2 runs in CTC mode and fires TIMER2_COMPA every tick, 1/RTC_TICKS_PER_SECOND
+s (1 ms, 1/256 s with RTC_CRYSTAL). The ISR keeps seconds, minutes and hours, so
+wall-clock time no longer depends on how long the main loop (LCD traffic, motor
+moves) takes.
+
+Time is kept in packed BCD (0x23:0x59:0x59) and incremented in place, so it can
+be shown without any division. A binary minute of the day (0-1439) is kept
+alongside for comparisons, and a BCD countdown is decremented every second.
+
+HOW TO USE
+----------
+- rtc_init(hours, minutes, seconds) with binary values, then sei()
+- rtc_set(hours, minutes, seconds) (binary) changes the time of a running
+  clock
+- rtc_get(&hours, &minutes, &seconds) returns a consistent BCD copy of the time
+- rtc_day_minute() returns hours * 60 + minutes
+- rtc_countdown_set(hours, minutes, seconds) (binary) starts the countdown,
+  rtc_countdown_get(&hours, &minutes, &seconds) reads it back in BCD. It wraps
+  from 00:00:00 to 23:59:59, i.e. it counts down to the same time every day.
+- rtc_second_flag is set by the ISR every second, clear it after handling
+- rtc_now() reads rtc_ticks, a free running counter in 1/RTC_TICKS_PER_SECOND
+  s (wraps after 65536 ticks, ~65 s or 256 s with RTC_CRYSTAL). Use it for
+  timeouts in ticks: (uint16_t)(rtc_now() - start) >= timeout
+- rtc_sleep(mode) sleeps until the next interrupt. mode is SLEEP_MODE_IDLE or
+  SLEEP_MODE_PWR_SAVE; without RTC_CRYSTAL it is always idle.
+- Define RTC_TICK_HOOK() before including this file to run extra code on every
+  tick from inside the ISR (keep it short)
+- rtc_uptime counts seconds since rtc_init(), rtc_get_uptime() reads it. It
+  does not wrap at midnight and ignores rtc_set(), use it for long intervals.
+
+CLOCK ACCURACY
+--------------
+Without RTC_CRYSTAL the clock is only as good as the internal RC oscillator
+(+-1 % from the factory, more with temperature). rtc_sync(hours, minutes,
+seconds) takes a reference time, e.g. sent over the serial console at the
+start of its second. From the second reference on, at least
+RTC_SYNC_MIN_SECONDS later, the drift seen in between trims the number of
+ticks per second: rtc_trim is in 1/256 tick per second, added up by a
+fractional accumulator, so at 1000 ticks per second one unit is 3.9 ppm
+(0.34 s a day). Every further reference refines it, which follows the slow
+temperature drift. Keep the trim with rtc_get_trim() and restore it with
+rtc_set_trim() after a reset.
+
+With RTC_CRYSTAL the time comes from the crystal and rtc_sync() only sets
+it. rtc_tune_cpu() then measures the CPU clock against the crystal and
+moves OSCCAL one step towards F_CPU, which keeps _delay_*(), Timer1 and the
+USART baud rate right. It returns 1 while it is still adjusting. It polls
+for RTC_TUNE_TICKS / 256 s (plus up to a tick for the first edge) with
+interrupts on; an edge that an ISR may have delayed spoils the measurement,
+which then returns 1 without a change. It borrows Timer1, so call it only
+while Timer1 is stopped (motor released).
+
+LOW POWER
+---------
+Define RTC_CRYSTAL before including this file when a 32.768 kHz crystal sits on
+TOSC1/TOSC2 (PB6/PB7). Timer2 then counts asynchronously at 256 Hz and keeps
+running in power-save sleep. The overflow wakes the CPU once per second.
+RTC_TICKS_PER_SECOND becomes 256 and the tick hook only runs while
+rtc_fast_ticks(1) is set, e.g. while the LCD queue has data.
+__________________________________________________________________________________*/
+
+#ifndef RTC_H
+#define RTC_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "hal.h"
+
+#ifdef RTC_CRYSTAL
+
+#define RTC_TICKS_PER_SECOND 256
+#define RTC_CLOCK_SELECT ((1 << CS22) | (1 << CS20)) // 32768 / 128 = 256 Hz
+
+#ifndef RTC_TUNE_TICKS
+#define RTC_TUNE_TICKS 4 // Crystal ticks per OSCCAL measurement, 15.6 ms
+#endif
+#define RTC_TUNE_TARGET ((uint16_t)(F_CPU / RTC_TICKS_PER_SECOND * RTC_TUNE_TICKS))
+#define RTC_TUNE_MARGIN (RTC_TUNE_TARGET / 200) // +-0.5 %, about one OSCCAL step
+// Longest poll of TCNT2 without an interrupt, twice this is below the margin
+// at the default RTC_TUNE_TICKS
+#define RTC_TUNE_POLL_CYCLES 32
+#define RTC_TUNE_STOPPED 0xFFFF
+#define RTC_TUNE_DISTURBED 0xFFFE
+
+#else
+
+/*--------------- SETUP HERE --------------------------------------------*/
+#define RTC_TICKS_PER_SECOND 1000
+/*-----------------------------------------------------------------------*/
+
+// Pick the smallest Timer2 prescaler that fits one tick in 8 bits
+#if F_CPU / 8 / RTC_TICKS_PER_SECOND <= 256
+	#define RTC_PRESCALER 8
+	#define RTC_CLOCK_SELECT (1 << CS21)
+#elif F_CPU / 32 / RTC_TICKS_PER_SECOND <= 256
+	#define RTC_PRESCALER 32
+	#define RTC_CLOCK_SELECT ((1 << CS21) | (1 << CS20))
+#elif F_CPU / 64 / RTC_TICKS_PER_SECOND <= 256
+	#define RTC_PRESCALER 64
+	#define RTC_CLOCK_SELECT (1 << CS22)
+#else
+	#error "RTC_TICKS_PER_SECOND too low for F_CPU"
+#endif
+
+#if F_CPU % (RTC_PRESCALER * RTC_TICKS_PER_SECOND) != 0
+	#warning "F_CPU is not a multiple of the RTC tick, the clock will drift"
+#endif
+
+#define RTC_COMPARE ((F_CPU / RTC_PRESCALER / RTC_TICKS_PER_SECOND) - 1)
+
+#endif // RTC_CRYSTAL
+
+#ifndef RTC_SYNC_MIN_SECONDS
+#define RTC_SYNC_MIN_SECONDS 3600 // Shortest reference interval used for the trim
+#endif
+#define RTC_TRIM_MAX (RTC_TICKS_PER_SECOND * 256L / 16) // +-6.25 %
+#define RTC_SYNC_TICK_SECONDS 900000 // Longer reference intervals are measured in seconds
+#if RTC_TICKS_PER_SECOND * 256L + RTC_TRIM_MAX >= (1L << 20) || RTC_TICKS_PER_SECOND * (RTC_SYNC_TICK_SECONDS * 17LL / 16) >= (1L << 30)
+	#error "RTC_TICKS_PER_SECOND too high for the trim arithmetic"
+#endif
+
+#ifndef RTC_TICK_HOOK
+#define RTC_TICK_HOOK()
+#endif
+
+volatile uint16_t rtc_ticks = 0; // With RTC_CRYSTAL only the high byte is kept, TCNT2 is the low byte
+volatile uint16_t rtc_subsecond = 0;
+volatile uint8_t rtc_seconds = 0, rtc_minutes = 0, rtc_hours = 0; // BCD
+volatile uint16_t rtc_minute_of_day = 0;
+volatile uint8_t rtc_left_seconds = 0, rtc_left_minutes = 0, rtc_left_hours = 0; // BCD
+volatile uint8_t rtc_second_flag = 0;
+volatile uint32_t rtc_uptime = 0;
+uint32_t rtc_sync_uptime = 0; // rtc_uptime at the last reference
+uint8_t rtc_synced = 0;
+#ifdef RTC_CRYSTAL
+uint8_t rtc_next_tick = 0; // OCR2A shadow, the asynchronous register is not read back
+uint16_t rtc_cpu_cycles = 0; // Last rtc_tune_cpu() measurement
+#else
+int16_t rtc_trim = 0; // 1/256 tick per second
+uint8_t rtc_trim_fraction = 0;
+uint16_t rtc_second_ticks = RTC_TICKS_PER_SECOND; // Length of the current second
+#endif
+
+// Binary (0-99) to packed BCD, only used when setting the time
+uint8_t rtc_bin_to_bcd(uint8_t value)
+{
+	uint8_t bcd = 0;
+	while(value >= 10)
+	{
+		value -= 10;
+		bcd += 0x10;
+	}
+	return bcd | value;
+}
+
+static inline uint8_t rtc_bcd_increment(uint8_t bcd)
+{
+	bcd++;
+	if((bcd & 0x0F) == 0x0A) bcd += 6; // 0x0A -> 0x10
+	return bcd;
+}
+
+static inline uint8_t rtc_bcd_decrement(uint8_t bcd)
+{
+	bcd--;
+	if((bcd & 0x0F) == 0x0F) bcd -= 6; // 0x0F -> 0x09
+	return bcd;
+}
+
+void rtc_init(uint8_t hours, uint8_t minutes, uint8_t seconds)
+{
+	rtc_hours = rtc_bin_to_bcd(hours);
+	rtc_minutes = rtc_bin_to_bcd(minutes);
+	rtc_seconds = rtc_bin_to_bcd(seconds);
+	rtc_minute_of_day = hours * 60 + minutes;
+	rtc_subsecond = 0;
+
+	#ifdef RTC_CRYSTAL
+	TIMSK2 = 0;
+	ASSR = (1 << AS2); // Clock Timer2 from the crystal
+	TCCR2A = 0; // Normal mode, overflow once per second
+	TCCR2B = RTC_CLOCK_SELECT;
+	TCNT2 = 0;
+	// Wait for the asynchronous registers to be updated
+	while(ASSR & ((1 << TCN2UB) | (1 << TCR2AUB) | (1 << TCR2BUB)));
+	TIFR2 = (1 << TOV2) | (1 << OCF2A) | (1 << OCF2B);
+	TIMSK2 = (1 << TOIE2);
+	#else
+	TCCR2A = (1 << WGM21); // CTC, TOP = OCR2A
+	TCCR2B = RTC_CLOCK_SELECT;
+	OCR2A = RTC_COMPARE;
+	TCNT2 = 0;
+	TIMSK2 = (1 << OCIE2A);
+	#endif
+}
+
+void rtc_set(uint8_t hours, uint8_t minutes, uint8_t seconds)
+{
+	uint8_t sreg = SREG;
+	cli();
+	rtc_hours = rtc_bin_to_bcd(hours);
+	rtc_minutes = rtc_bin_to_bcd(minutes);
+	rtc_seconds = rtc_bin_to_bcd(seconds);
+	rtc_minute_of_day = hours * 60 + minutes;
+	rtc_synced = 0; // Not a reference, the next rtc_sync() starts over
+	SREG = sreg;
+}
+
+#ifndef RTC_CRYSTAL
+void rtc_set_trim(int16_t trim)
+{
+	uint8_t sreg = SREG;
+	cli();
+	rtc_trim = trim;
+	SREG = sreg;
+}
+
+int16_t rtc_get_trim(void)
+{
+	int16_t trim;
+	uint8_t sreg = SREG;
+	cli();
+	trim = rtc_trim;
+	SREG = sreg;
+	return trim;
+}
+#endif
+
+#ifndef RTC_CRYSTAL
+// value * num / den rounded, for value < 2^20 and num < den < 2^30, by shift
+// and subtract like a long division: no 64 bit product, no library call
+static uint32_t rtc_scale(uint32_t value, uint32_t num, uint32_t den)
+{
+	uint32_t result = 0, rest = 0, bit;
+
+	for(bit = 1UL << 19; bit; bit >>= 1)
+	{
+		result <<= 1;
+		rest <<= 1;
+		if(value & bit) rest += num;
+		while(rest >= den)
+		{
+			rest -= den;
+			result++;
+		}
+	}
+	return rest * 2 >= den ? result + 1 : result;
+}
+#endif
+
+// Reference time (binary), taken at the start of its second. Returns 1 if the
+// trim changed.
+uint8_t rtc_sync(uint8_t hours, uint8_t minutes, uint8_t seconds)
+{
+	uint8_t changed = 0;
+	#ifndef RTC_CRYSTAL
+	int32_t error, elapsed, behind;
+	uint32_t seconds_up;
+	uint16_t subsecond;
+	uint8_t synced;
+	#endif
+	uint8_t sreg = SREG;
+	cli();
+
+	#ifndef RTC_CRYSTAL
+	// Only take what the trim needs here, it is worked out with interrupts on
+	error = (hours * 60L + minutes) * 60 + seconds
+		- (rtc_minute_of_day * 60L + (rtc_seconds >> 4) * 10 + (rtc_seconds & 0x0F));
+	seconds_up = rtc_uptime - rtc_sync_uptime;
+	subsecond = rtc_subsecond;
+	synced = rtc_synced;
+	rtc_subsecond = 0;
+	TCNT2 = 0; // The next second starts now
+	#endif
+
+	rtc_hours = rtc_bin_to_bcd(hours);
+	rtc_minutes = rtc_bin_to_bcd(minutes);
+	rtc_seconds = rtc_bin_to_bcd(seconds);
+	rtc_minute_of_day = hours * 60 + minutes;
+	rtc_sync_uptime = rtc_uptime;
+	rtc_synced = 1;
+	SREG = sreg;
+
+	#ifndef RTC_CRYSTAL
+	// Seconds the clock is behind the reference, within half a day
+	if(error > 12 * 3600L) error -= 24 * 3600L;
+	if(error < -12 * 3600L) error += 24 * 3600L;
+	if(!synced || seconds_up < RTC_SYNC_MIN_SECONDS) return 0;
+
+	// In ticks. Over RTC_SYNC_TICK_SECONDS that would not fit, but a second
+	// is then below 1 ppm and the fraction can go.
+	if(seconds_up < RTC_SYNC_TICK_SECONDS)
+	{
+		elapsed = seconds_up * RTC_TICKS_PER_SECOND + subsecond;
+		behind = error * RTC_TICKS_PER_SECOND - subsecond;
+	}
+	else
+	{
+		elapsed = seconds_up;
+		behind = error;
+	}
+
+	if(behind * 16 < elapsed && -behind * 16 < elapsed)
+	{
+		// The clock counted "elapsed" ticks while "elapsed + behind" passed
+		int16_t trim = rtc_get_trim();
+		int32_t step = rtc_scale(RTC_TICKS_PER_SECOND * 256L + trim, behind < 0 ? -behind : behind, elapsed + behind);
+		int32_t trimmed = behind < 0 ? trim + step : trim - step;
+
+		if(trimmed > RTC_TRIM_MAX) trimmed = RTC_TRIM_MAX;
+		if(trimmed < -RTC_TRIM_MAX) trimmed = -RTC_TRIM_MAX;
+		rtc_set_trim(trimmed);
+		changed = 1;
+	}
+	#endif
+	return changed;
+}
+
+// Run RTC_TICK_HOOK on every tick (always on without RTC_CRYSTAL)
+void rtc_fast_ticks(uint8_t on)
+{
+	#ifdef RTC_CRYSTAL
+	uint8_t sreg = SREG;
+	cli();
+	if(on && !(TIMSK2 & (1 << OCIE2A)))
+	{
+		while(ASSR & (1 << OCR2AUB));
+		rtc_next_tick = TCNT2 + 1;
+		OCR2A = rtc_next_tick;
+		TIFR2 = (1 << OCF2A);
+		TIMSK2 |= (1 << OCIE2A);
+	}
+	else if(!on)
+	{
+		TIMSK2 &= ~(1 << OCIE2A);
+	}
+	SREG = sreg;
+	#else
+	(void)on;
+	#endif
+}
+
+void rtc_get(uint8_t *hours, uint8_t *minutes, uint8_t *seconds)
+{
+	uint8_t sreg = SREG;
+	cli();
+	*hours = rtc_hours;
+	*minutes = rtc_minutes;
+	*seconds = rtc_seconds;
+	SREG = sreg;
+}
+
+uint16_t rtc_day_minute(void)
+{
+	uint16_t minute;
+	uint8_t sreg = SREG;
+	cli();
+	minute = rtc_minute_of_day;
+	SREG = sreg;
+	return minute;
+}
+
+uint32_t rtc_get_uptime(void)
+{
+	uint32_t uptime;
+	uint8_t sreg = SREG;
+	cli();
+	uptime = rtc_uptime;
+	SREG = sreg;
+	return uptime;
+}
+
+void rtc_countdown_set(uint8_t hours, uint8_t minutes, uint8_t seconds)
+{
+	uint8_t sreg = SREG;
+	cli();
+	rtc_left_hours = rtc_bin_to_bcd(hours);
+	rtc_left_minutes = rtc_bin_to_bcd(minutes);
+	rtc_left_seconds = rtc_bin_to_bcd(seconds);
+	SREG = sreg;
+}
+
+void rtc_countdown_get(uint8_t *hours, uint8_t *minutes, uint8_t *seconds)
+{
+	uint8_t sreg = SREG;
+	cli();
+	*hours = rtc_left_hours;
+	*minutes = rtc_left_minutes;
+	*seconds = rtc_left_seconds;
+	SREG = sreg;
+}
+
+static inline void rtc_countdown_tick(void)
+{
+	if(rtc_left_seconds) { rtc_left_seconds = rtc_bcd_decrement(rtc_left_seconds); return; }
+	rtc_left_seconds = 0x59;
+	if(rtc_left_minutes) { rtc_left_minutes = rtc_bcd_decrement(rtc_left_minutes); return; }
+	rtc_left_minutes = 0x59;
+	if(rtc_left_hours) { rtc_left_hours = rtc_bcd_decrement(rtc_left_hours); return; }
+	rtc_left_hours = 0x23;
+}
+
+uint16_t rtc_now(void)
+{
+	uint16_t ticks;
+	uint8_t sreg = SREG;
+	cli();
+	#ifdef RTC_CRYSTAL
+	uint8_t low = TCNT2;
+	ticks = rtc_ticks;
+	// Overflow pending but not serviced yet
+	if((TIFR2 & (1 << TOV2)) && low < 0x80) ticks += 0x100;
+	ticks |= low;
+	#else
+	ticks = rtc_ticks;
+	#endif
+	SREG = sreg;
+	return ticks;
+}
+
+#ifdef RTC_CRYSTAL
+// Timer1 count when TCNT2 has moved "ticks" on from "tick". The edge lies
+// between the last two polls, so it is only taken if nothing ran in between:
+// more than RTC_TUNE_POLL_CYCLES from one poll to the next means an ISR did.
+static uint16_t rtc_tune_edge(uint8_t tick, uint8_t ticks)
+{
+	uint16_t last = TCNT1, now;
+
+	for(;;)
+	{
+		now = TCNT1;
+		if((uint8_t)(TCNT2 - tick) >= ticks) break;
+		if(TIFR1 & (1 << TOV1)) return RTC_TUNE_STOPPED; // The crystal is not running
+		last = now;
+		HAL_POLL();
+	}
+	return now - last > RTC_TUNE_POLL_CYCLES ? RTC_TUNE_DISTURBED : now;
+}
+
+// Counts CPU cycles over RTC_TUNE_TICKS crystal ticks and moves OSCCAL one
+// step towards F_CPU. Interrupts stay on. Returns 1 if OSCCAL changed or an
+// interrupt spoilt the measurement, so call it again.
+uint8_t rtc_tune_cpu(void)
+{
+	uint8_t tccr1a = TCCR1A, tccr1b = TCCR1B, timsk1 = TIMSK1, tick;
+	uint16_t start, end, cycles;
+
+	TIMSK1 = 0; // Compare matches of the borrowed timer are not for the motor ISR
+	TCCR1B = 0; // Normal mode, clk/1
+	TCCR1A = 0;
+	TCNT1 = 0;
+	TIFR1 = (1 << TOV1);
+	TCCR1B = (1 << CS10);
+	tick = TCNT2;
+	start = rtc_tune_edge(tick, 1);
+	end = start < RTC_TUNE_DISTURBED ? rtc_tune_edge(tick, RTC_TUNE_TICKS + 1) : start;
+
+	TCCR1B = tccr1b;
+	TCCR1A = tccr1a;
+	TIFR1 = (1 << OCF1A) | (1 << TOV1);
+	TIMSK1 = timsk1;
+
+	if(end == RTC_TUNE_STOPPED) return 0;
+	if(end == RTC_TUNE_DISTURBED) return 1;
+	cycles = end - start;
+	rtc_cpu_cycles = cycles;
+	// Each half of the range (bit 7) is monotonic, never cross between them
+	if(cycles > RTC_TUNE_TARGET + RTC_TUNE_MARGIN && (OSCCAL & 0x7F) != 0x00)
+	{
+		OSCCAL--;
+		return 1;
+	}
+	if(cycles < RTC_TUNE_TARGET - RTC_TUNE_MARGIN && (OSCCAL & 0x7F) != 0x7F)
+	{
+		OSCCAL++;
+		return 1;
+	}
+	return 0;
+}
+#endif
+
+void rtc_sleep(uint8_t mode)
+{
+	#ifdef RTC_CRYSTAL
+	// After a Timer2 wake up the interrupt logic needs one TOSC cycle to
+	// reset. A dummy write that has to sync to the crystal covers it.
+	OCR2B = 0;
+	while(ASSR & (1 << OCR2BUB));
+	#else
+	mode = SLEEP_MODE_IDLE; // Timer2 is clocked from the CPU clock
+	#endif
+
+	set_sleep_mode(mode);
+	cli();
+	sleep_enable();
+	sei(); // sei + sleep are executed atomically, no tick can be missed
+	sleep_cpu();
+	sleep_disable();
+}
+
+static inline void rtc_second(void)
+{
+	rtc_second_flag = 1;
+	rtc_uptime++;
+	rtc_countdown_tick();
+
+	rtc_seconds = rtc_bcd_increment(rtc_seconds);
+	if(rtc_seconds < 0x60) return;
+	rtc_seconds = 0;
+
+	if(++rtc_minute_of_day >= 24 * 60) rtc_minute_of_day = 0;
+
+	rtc_minutes = rtc_bcd_increment(rtc_minutes);
+	if(rtc_minutes < 0x60) return;
+	rtc_minutes = 0;
+
+	rtc_hours = rtc_bcd_increment(rtc_hours);
+	if(rtc_hours < 0x24) return;
+	rtc_hours = 0;
+}
+
+#ifdef RTC_CRYSTAL
+ISR(TIMER2_OVF_vect)
+{
+	rtc_ticks += RTC_TICKS_PER_SECOND;
+	rtc_second();
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+	OCR2A = ++rtc_next_tick; // Next tick, 1/256 s later
+	RTC_TICK_HOOK();
+}
+#else
+ISR(TIMER2_COMPA_vect)
+{
+	rtc_ticks++;
+	RTC_TICK_HOOK();
+
+	if(++rtc_subsecond < rtc_second_ticks) return;
+	rtc_subsecond = 0;
+
+	// Whole ticks of the trim plus the carry of its fraction
+	uint16_t fraction = rtc_trim_fraction + (rtc_trim & 0xFF);
+	rtc_second_ticks = RTC_TICKS_PER_SECOND + (rtc_trim >> 8) + (fraction >> 8);
+	rtc_trim_fraction = fraction;
+	rtc_second();
+}
+#endif
+
+#endif // RTC_H
@@ -0,0 +1,175 @@
+/*_______________________________________________________________________________
+schedule.h - Feeding schedule with a precomputed next deadline
+
+Each feeding has a time of day, a window and a portion. A feeding window opens
+"window - 1" minutes before the feeding time, during which a button press
+dispenses the portion, and closes "window" minutes after it. If nobody pressed
+the button by then, the portion is dispensed on timeout. This is the behaviour
+of the old single SET_HOUR/SET_MINUTE/TIME_WINDOW feeding, repeated per slot.
+
+The table is kept sorted by time of day and only the minute of the next state
+change (schedule_deadline) is tracked, so the main loop does one compare:
+
+	if(rtc_day_minute() == schedule_deadline) steps = schedule_event();
+
+HOW TO USE
+----------
+- feeding_t table[] = { FEEDING(8, 0, 20, 512), FEEDING(18, 30, 20, 512) };
+  Windows must not overlap.
+- schedule_init(table, count, rtc_day_minute()) sorts the table and finds
+  where in the day we are. Call it again after editing the table.
+- schedule_event() when the deadline is reached, returns the steps to dispense
+  if a window timed out without a press, 0 otherwise
+- schedule_press() returns the steps to dispense when the button is pressed in
+  an open window that has not been used yet, 0 otherwise
+- schedule_mark_used() marks the open window as used without a press, after
+  a resume from a clock checkpoint saved when it was used
+- schedule_next_minute() is the time of day of the next feeding, SCHEDULE_NONE
+  if the table is empty
+__________________________________________________________________________________*/
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <avr/io.h>
+
+#define SCHEDULE_DAY (24 * 60)
+#define SCHEDULE_MAX 8
+
+#define FEEDING(hours, minutes, window, steps) {(hours) * 60 + (minutes), window, steps}
+
+#define SCHEDULE_CLOSED 0 // Waiting for the window to open
+#define SCHEDULE_OPEN 1 // Window open, feeding time not reached yet
+#define SCHEDULE_DUE 2 // Window open, feeding time passed
+
+#define SCHEDULE_NONE 0xFFFF // Never matches a minute of the day
+
+typedef struct
+{
+	uint16_t minute; // Time of day, hours * 60 + minutes
+	uint8_t window; // Minutes, at least 1
+	uint16_t steps; // Portion, motor steps per direction
+} __attribute__((packed)) feeding_t; // Stored in EEPROM by config.h
+
+feeding_t *schedule_table;
+uint8_t schedule_count = 0;
+uint8_t schedule_index = 0;
+uint8_t schedule_phase = SCHEDULE_CLOSED;
+uint8_t schedule_used = 0;
+uint16_t schedule_used_minute = SCHEDULE_NONE; // Feeding time of the used window
+uint16_t schedule_deadline = SCHEDULE_NONE;
+
+static uint16_t schedule_wrap(int16_t minute)
+{
+	if(minute < 0) return minute + SCHEDULE_DAY;
+	if(minute >= SCHEDULE_DAY) return minute - SCHEDULE_DAY;
+	return minute;
+}
+
+static void schedule_set_deadline(void)
+{
+	feeding_t *slot = &schedule_table[schedule_index];
+
+	if(schedule_phase == SCHEDULE_CLOSED) schedule_deadline = schedule_wrap(slot->minute - slot->window + 1);
+	else if(schedule_phase == SCHEDULE_OPEN) schedule_deadline = slot->minute;
+	else schedule_deadline = schedule_wrap(slot->minute + slot->window);
+}
+
+void schedule_init(feeding_t *table, uint8_t count, uint16_t now)
+{
+	uint8_t i, j, best = 0;
+	uint16_t distance, nearest = 0xFFFF;
+	feeding_t temp;
+
+	schedule_table = table;
+	schedule_count = count;
+	schedule_deadline = SCHEDULE_NONE;
+	if(count == 0)
+	{
+		schedule_used = 0;
+		return;
+	}
+
+	// Insertion sort, the table is tiny
+	for(i = 1; i < count; i++)
+	{
+		temp = table[i];
+		for(j = i; j > 0 && table[j - 1].minute > temp.minute; j--) table[j] = table[j - 1];
+		table[j] = temp;
+	}
+
+	// The slot whose window closes next, strictly after now
+	for(i = 0; i < count; i++)
+	{
+		distance = schedule_wrap(table[i].minute + table[i].window - now - 1);
+		if(distance < nearest)
+		{
+			nearest = distance;
+			best = i;
+		}
+	}
+
+	// Minutes left until it closes tell which part of the window we are in
+	distance = nearest + 1;
+	schedule_index = best;
+	if(distance <= table[best].window) schedule_phase = SCHEDULE_DUE;
+	else if(distance < 2 * table[best].window) schedule_phase = SCHEDULE_OPEN;
+	else schedule_phase = SCHEDULE_CLOSED;
+
+	// Still in the window a press already used: an edit must not reopen it
+	schedule_used = schedule_used && schedule_phase != SCHEDULE_CLOSED
+		&& table[best].minute == schedule_used_minute;
+
+	schedule_set_deadline();
+}
+
+uint16_t schedule_event(void)
+{
+	uint16_t steps = 0;
+
+	if(schedule_phase == SCHEDULE_CLOSED)
+	{
+		schedule_phase = SCHEDULE_OPEN;
+		schedule_used = 0;
+	}
+	else if(schedule_phase == SCHEDULE_OPEN)
+	{
+		schedule_phase = SCHEDULE_DUE;
+	}
+	else
+	{
+		if(!schedule_used) steps = schedule_table[schedule_index].steps;
+		schedule_phase = SCHEDULE_CLOSED;
+		if(++schedule_index >= schedule_count) schedule_index = 0;
+	}
+
+	schedule_set_deadline();
+	return steps;
+}
+
+void schedule_mark_used(void)
+{
+	if(schedule_count == 0 || schedule_phase == SCHEDULE_CLOSED) return;
+
+	schedule_used = 1;
+	schedule_used_minute = schedule_table[schedule_index].minute;
+}
+
+uint16_t schedule_press(void)
+{
+	if(schedule_phase == SCHEDULE_CLOSED || schedule_used) return 0;
+
+	schedule_mark_used();
+	return schedule_table[schedule_index].steps;
+}
+
+uint16_t schedule_next_minute(void)
+{
+	uint8_t next = schedule_index;
+
+	if(schedule_count == 0) return SCHEDULE_NONE;
+	if(schedule_phase == SCHEDULE_DUE && ++next >= schedule_count) next = 0;
+	return schedule_table[next].minute;
+}
+
+#endif // SCHEDULE_H
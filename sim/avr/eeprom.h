@@ -0,0 +1,44 @@
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <stdint.h>
+#include "sim.h"
+
+#define EEMEM
+
+static inline uint8_t eeprom_is_ready(void)
+{
+	return sim_eeprom_ready();
+}
+
+static inline uint8_t eeprom_read_byte(const uint8_t *address)
+{
+	return sim_eeprom_read((uint16_t)(uintptr_t)address);
+}
+
+static inline void eeprom_write_byte(uint8_t *address, uint8_t value)
+{
+	sim_eeprom_write((uint16_t)(uintptr_t)address, value);
+}
+
+static inline void eeprom_update_byte(uint8_t *address, uint8_t value)
+{
+	if(eeprom_read_byte(address) != value) eeprom_write_byte(address, value);
+}
+
+static inline void eeprom_read_block(void *destination, const void *source, size_t size)
+{
+	for(size_t i = 0; i < size; i++) ((uint8_t *)destination)[i] = eeprom_read_byte((const uint8_t *)source + i);
+}
+
+static inline void eeprom_write_block(const void *source, void *destination, size_t size)
+{
+	for(size_t i = 0; i < size; i++) eeprom_write_byte((uint8_t *)destination + i, ((const uint8_t *)source)[i]);
+}
+
+static inline void eeprom_update_block(const void *source, void *destination, size_t size)
+{
+	for(size_t i = 0; i < size; i++) eeprom_update_byte((uint8_t *)destination + i, ((const uint8_t *)source)[i]);
+}
+
+#endif // SIM_AVR_EEPROM_H
@@ -0,0 +1,10 @@
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include "sim.h"
+
+#define ISR(vector) extern "C" void vector(void)
+#define sei() sim_sei()
+#define cli() sim_cli()
+
+#endif // SIM_AVR_INTERRUPT_H
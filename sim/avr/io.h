@@ -0,0 +1,165 @@
+/*_______________________________________________________________________________
+avr/io.h - ATmega328P registers and bit names for the host simulation
+__________________________________________________________________________________*/
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+#include "sim.h"
+
+#define SIM_REGISTER8(name) static sim_register<SIM_##name, uint8_t> name __attribute__((unused));
+#define SIM_REGISTER16(name) static sim_register<SIM_##name, uint16_t> name __attribute__((unused));
+
+SIM_REGISTER8(PINB) SIM_REGISTER8(DDRB) SIM_REGISTER8(PORTB)
+SIM_REGISTER8(PINC) SIM_REGISTER8(DDRC) SIM_REGISTER8(PORTC)
+SIM_REGISTER8(PIND) SIM_REGISTER8(DDRD) SIM_REGISTER8(PORTD)
+SIM_REGISTER8(TCCR0A) SIM_REGISTER8(TCCR0B) SIM_REGISTER8(TCNT0) SIM_REGISTER8(OCR0A)
+SIM_REGISTER8(OCR0B) SIM_REGISTER8(TIMSK0) SIM_REGISTER8(TIFR0)
+SIM_REGISTER8(TCCR1A) SIM_REGISTER8(TCCR1B) SIM_REGISTER16(TCNT1) SIM_REGISTER16(OCR1A)
+SIM_REGISTER16(OCR1B) SIM_REGISTER8(TIMSK1) SIM_REGISTER8(TIFR1)
+SIM_REGISTER8(TCCR2A) SIM_REGISTER8(TCCR2B) SIM_REGISTER8(TCNT2) SIM_REGISTER8(OCR2A)
+SIM_REGISTER8(OCR2B) SIM_REGISTER8(TIMSK2) SIM_REGISTER8(TIFR2) SIM_REGISTER8(ASSR)
+SIM_REGISTER8(PCICR) SIM_REGISTER8(PCIFR) SIM_REGISTER8(PCMSK0) SIM_REGISTER8(PCMSK1)
+SIM_REGISTER8(PCMSK2)
+SIM_REGISTER16(UBRR0) SIM_REGISTER8(UCSR0A) SIM_REGISTER8(UCSR0B) SIM_REGISTER8(UCSR0C)
+SIM_REGISTER8(UDR0)
+SIM_REGISTER8(MCUSR) SIM_REGISTER8(SREG) SIM_REGISTER8(SMCR) SIM_REGISTER8(CLKPR)
+SIM_REGISTER8(OSCCAL) SIM_REGISTER8(WDTCSR) SIM_REGISTER8(PRR)
+
+#define _BV(bit) (1 << (bit))
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// Timer0
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define WGM01 1
+#define WGM00 0
+#define WGM02 3
+#define CS02 2
+#define CS01 1
+#define CS00 0
+
+// Timer1
+#define COM1A1 7
+#define COM1A0 6
+#define WGM11 1
+#define WGM10 0
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1 0
+#define OCF1B 2
+#define OCF1A 1
+#define TOV1 0
+
+// Timer2
+#define COM2A1 7
+#define COM2A0 6
+#define COM2B1 5
+#define COM2B0 4
+#define WGM21 1
+#define WGM20 0
+#define WGM22 3
+#define CS22 2
+#define CS21 1
+#define CS20 0
+#define OCIE2B 2
+#define OCIE2A 1
+#define TOIE2 0
+#define OCF2B 2
+#define OCF2A 1
+#define TOV2 0
+#define EXCLK 6
+#define AS2 5
+#define TCN2UB 4
+#define OCR2AUB 3
+#define OCR2BUB 2
+#define TCR2AUB 1
+#define TCR2BUB 0
+
+// Pin change interrupts
+#define PCIE2 2
+#define PCIE1 1
+#define PCIE0 0
+#define PCIF2 2
+#define PCIF1 1
+#define PCIF0 0
+
+// USART0
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+#define U2X0 1
+#define MPCM0 0
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ02 2
+#define UMSEL01 7
+#define UMSEL00 6
+#define UPM01 5
+#define UPM00 4
+#define USBS0 3
+#define UCSZ01 2
+#define UCSZ00 1
+
+// System
+#define WDRF 3
+#define BORF 2
+#define EXTRF 1
+#define PORF 0
+#define CLKPCE 7
+#define CLKPS3 3
+#define CLKPS2 2
+#define CLKPS1 1
+#define CLKPS0 0
+#define SE 0
+#define SREG_I 7
+#define WDIF 7
+#define WDIE 6
+#define WDP3 5
+#define WDCE 4
+#define WDE 3
+#define WDP2 2
+#define WDP1 1
+#define WDP0 0
+
+#define E2END 0x3FF
+#define RAMEND 0x8FF
+
+#endif // SIM_AVR_IO_H
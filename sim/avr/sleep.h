@@ -0,0 +1,19 @@
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#include "sim.h"
+
+#define SLEEP_MODE_IDLE 0x00
+#define SLEEP_MODE_ADC 0x02
+#define SLEEP_MODE_PWR_DOWN 0x04
+#define SLEEP_MODE_PWR_SAVE 0x06
+#define SLEEP_MODE_STANDBY 0x0C
+#define SLEEP_MODE_EXT_STANDBY 0x0E
+
+#define set_sleep_mode(mode) sim_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu() sim_sleep()
+#define sleep_mode() sim_sleep()
+
+#endif // SIM_AVR_SLEEP_H
@@ -0,0 +1,452 @@
+/*_______________________________________________________________________________
+lcd_test.c - Checks of OnLCDLib.h against the LCD model of the simulator
+
+Built and run by "make simtest". Each check draws through the library, then
+compares every cell on screen with what it should show. A custom character
+is compared by its bitmap in CGRAM, so a glyph in the wrong slot fails even
+if the code looks right. One line per failed cell or count, a summary at the
+end, and the exit status is 1 if anything failed.
+
+Covered:
+- big digits: a 3 characters wide m:ss clock through the frame, two minutes
+  of ticks, the bytes a tick costs, and clipping at the right edge
+- glyphs: an icons page through the frame, loading glyphs that are in CGRAM
+  already, and new glyphs loaded after LCDFrameClear() while the old ones are
+  still on screen
+- flash strings: LCDFrameWriteFormat_P() with each code and clipped at the
+  end of the frame, LCDFrameWriteString_P(), LCDWriteStringXY_P() wrapping to
+  the next line with a "%1" glyph, and each window of LCDScrollText_P()
+- LCDPrintf() and LCDFramePrintf(): the toScreen() layout of feeder.c,
+  padding with zeros and spaces, signs, the largest %u, and %c with %% clipped
+  at the end of the frame
+- pages: a page composed while hidden does not show until LCDPageShow(), the
+  commands a page change takes, flushes on page 1 and flips both ways
+__________________________________________________________________________________*/
+
+#include "hal.h"
+#include <avr/io.h>
+#include <util/delay.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LCD_FRAMEBUFFER
+#define CUSTOM_CHARS
+#define LCD_ANIMATIONS
+#define LCD_PAGES
+// The delays of the library come through here, to look at the screen between
+// the steps of an animation
+static void test_delay_ms(double ms);
+#define _delay_ms(ms) test_delay_ms(ms)
+#include "OnLCDLib.h"
+#undef _delay_ms
+
+#define TEST_COLUMNS LCD_NR_OF_CHARACTERS
+#define TEST_ROWS LCD_NR_OF_ROWS
+
+// What each cell should show: a glyph in flash, or else a character code
+static const uint8_t *test_glyph[TEST_ROWS][TEST_COLUMNS];
+static uint8_t test_char[TEST_ROWS][TEST_COLUMNS];
+static int test_checks = 0, test_failures = 0;
+static const char *test_scroll_text; // In flash, while it scrolls
+static uint8_t test_scroll_shift;
+
+static void test_fail(const char *what, const char *text)
+{
+	printf("lcd_test: %s: %s\n", what, text);
+	test_failures++;
+}
+
+static void test_expect_clear(void)
+{
+	memset(test_glyph, 0, sizeof(test_glyph));
+	memset(test_char, ' ', sizeof(test_char));
+}
+
+static void test_expect_char(uint8_t row, uint8_t column, uint8_t code)
+{
+	if(column >= TEST_COLUMNS) return;
+	test_glyph[row][column] = 0;
+	test_char[row][column] = code;
+}
+
+static void test_expect_glyph(uint8_t row, uint8_t column, const uint8_t *glyph)
+{
+	if(column >= TEST_COLUMNS) return;
+	test_glyph[row][column] = glyph;
+}
+
+static void test_expect_text(uint8_t row, uint8_t column, const char *text)
+{
+	while(*text) test_expect_char(row, column++, *text++);
+}
+
+// A digit of the big font at "column", as LCDFrameWriteBigDigit() lays it out
+static void test_expect_big_digit(uint8_t column, uint8_t digit)
+{
+	uint8_t row, i, code;
+
+	for(row = 0; row < 2; row++)
+	{
+		for(i = 0; i < LCD_BIG_WIDTH; i++)
+		{
+			code = pgm_read_byte(&LCD_BIG_FONT[digit][row * LCD_BIG_WIDTH + i]);
+			if(code < 8) test_expect_glyph(row, column + i, &LCD_custom_chars[code * 8]);
+			else test_expect_char(row, column + i, code);
+		}
+		if(LCD_BIG_GAP) test_expect_char(row, column + LCD_BIG_WIDTH, ' ');
+	}
+}
+
+// Compares the screen with the expectation
+static void test_screen(const char *what)
+{
+	uint8_t row, column, code, i;
+	char text[64];
+
+	test_checks++;
+	for(row = 0; row < TEST_ROWS; row++)
+	{
+		for(column = 0; column < TEST_COLUMNS; column++)
+		{
+			code = sim_lcd_screen(row, column);
+			if(!test_glyph[row][column])
+			{
+				if(code == test_char[row][column]) continue;
+				snprintf(text, sizeof(text), "cell %u,%u shows 0x%02X, not 0x%02X", column + 1, row + 1,
+					code, test_char[row][column]);
+				test_fail(what, text);
+				continue;
+			}
+			if(code >= 8)
+			{
+				snprintf(text, sizeof(text), "cell %u,%u shows 0x%02X, not a custom char", column + 1, row + 1, code);
+				test_fail(what, text);
+				continue;
+			}
+			for(i = 0; i < 8; i++)
+			{
+				if(sim_lcd_cgram(code * 8 + i) == pgm_read_byte(&test_glyph[row][column][i])) continue;
+				snprintf(text, sizeof(text), "cell %u,%u slot %u holds another bitmap", column + 1, row + 1, code);
+				test_fail(what, text);
+				break;
+			}
+		}
+	}
+}
+
+// Fails if "bytes" is over "most"
+static void test_bytes(const char *what, unsigned long bytes, unsigned long most)
+{
+	char text[64];
+
+	test_checks++;
+	if(bytes <= most) return;
+	snprintf(text, sizeof(text), "%lu bytes, expected at most %lu", bytes, most);
+	test_fail(what, text);
+}
+
+// LCDScrollText() waits once after each display shift: check the window
+static void test_delay_ms(double ms)
+{
+	uint8_t column;
+	int index;
+
+	if(test_scroll_text)
+	{
+		test_scroll_shift++;
+		test_expect_clear();
+		for(column = 0; column < TEST_COLUMNS; column++)
+		{
+			index = test_scroll_shift + column - TEST_COLUMNS;
+			if(index >= 0 && index < (int)strlen_P(test_scroll_text))
+			{
+				test_expect_char(0, column, pgm_read_byte(&test_scroll_text[index]));
+			}
+		}
+		test_screen("scroll window");
+	}
+	_delay_ms(ms);
+}
+
+/* ----------------------------------- BIG DIGITS */
+// m:ss, the minute at column 1, the seconds from column 6 on
+static void test_big_clock(uint8_t minutes, uint8_t seconds)
+{
+	test_expect_clear();
+	test_expect_big_digit(0, minutes);
+	test_expect_char(0, 4, LCD_BIG_DOT);
+	test_expect_char(1, 4, LCD_BIG_DOT);
+	test_expect_big_digit(5, seconds / 10);
+	test_expect_big_digit(9, seconds % 10);
+}
+
+static void test_big_digits(void)
+{
+	unsigned long bytes, most = 0, start;
+	uint8_t minutes, seconds;
+
+	LCDClear();
+	LCDFrameClear();
+	memset(LCD_shadow, ' ', sizeof(LCD_shadow));
+	start = sim_lcd_bytes();
+	for(minutes = 0; minutes < 2; minutes++)
+	{
+		for(seconds = 0; seconds < 60; seconds++)
+		{
+			bytes = sim_lcd_bytes();
+			LCDFrameGotoXY(1, 1);
+			LCDFrameWriteBigDigit(minutes);
+			LCDFrameWriteBigSeparator();
+			LCDFrameWriteBigBCD(((seconds / 10) << 4) | (seconds % 10));
+			LCDFlush();
+			bytes = sim_lcd_bytes() - bytes;
+			// In the second minute every glyph is in CGRAM already
+			if(minutes && seconds % 10 && bytes > most) most = bytes;
+
+			test_big_clock(minutes, seconds);
+			test_screen("big digit clock");
+		}
+	}
+	// Only the last digit changed: a cursor move and its cells on each row
+	test_bytes("big digit tick", most, 2 * (1 + LCD_BIG_WIDTH));
+	printf("lcd_test: big digit clock, %lu bytes for 120 ticks, at most %lu a tick\n",
+		sim_lcd_bytes() - start, most);
+
+	// A digit without room for its last column is not drawn
+	LCDFrameGotoXY(LCD_NR_OF_CHARACTERS - LCD_BIG_WIDTH - LCD_BIG_GAP + 2, 1);
+	LCDFrameWriteBigDigit(8);
+	LCDFlush();
+	test_screen("big digit at the edge");
+}
+
+/* ----------------------------------- GLYPHS */
+static const uint8_t test_icons[3][8] PROGMEM = {
+	{0x04, 0x0E, 0x0E, 0x0E, 0x1F, 0x00, 0x04, 0x00},	// Bell
+	{0x00, 0x0A, 0x1F, 0x1F, 0x0E, 0x04, 0x00, 0x00},	// Heart
+	{0x1F, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1F},	// Box
+};
+
+static void test_glyphs(void)
+{
+	unsigned long bytes;
+
+	// Icons next to text, one of them on the second row
+	LCDFrameClear();
+	LCD_frame[0] = LCDGlyph(test_icons[0]);
+	LCD_frame[1] = LCDGlyph(test_icons[1]);
+	LCD_frame[LCD_NR_OF_CHARACTERS + 1] = LCDGlyph(test_icons[2]);
+	LCDFrameWriteStringXY(4, 1, "Feed");
+	LCDFlush();
+	test_expect_clear();
+	test_expect_glyph(0, 0, test_icons[0]);
+	test_expect_glyph(0, 1, test_icons[1]);
+	test_expect_glyph(1, 1, test_icons[2]);
+	test_expect_char(0, 3, 'F');
+	test_expect_char(0, 4, 'e');
+	test_expect_char(0, 5, 'e');
+	test_expect_char(0, 6, 'd');
+	test_screen("icons page");
+
+	// Glyphs in CGRAM already cost nothing
+	bytes = sim_lcd_bytes();
+	LCDGlyphLoad(test_icons[0], 3);
+	test_bytes("loading resident glyphs", sim_lcd_bytes() - bytes, 0);
+
+	// A big 1 on screen, its glyphs made the least recently used ones. The
+	// frame is cleared, so until the next flush only the screen shows them:
+	// the icons must go into the other slots.
+	LCDFrameClear();
+	LCDFrameGotoXY(1, 1);
+	LCDFrameWriteBigDigit(1);
+	LCDFlush();
+	LCDGlyphLoad(LCD_custom_chars, 8);
+	test_expect_clear();
+	test_expect_big_digit(0, 1);
+	test_screen("big digit");
+	LCDFrameClear();
+	LCDGlyphLoad(test_icons[0], 3);
+	test_screen("glyphs loaded after a frame clear");
+
+	LCD_frame[0] = LCDGlyph(test_icons[0]);
+	LCD_frame[1] = LCDGlyph(test_icons[1]);
+	LCD_frame[2] = LCDGlyph(test_icons[2]);
+	LCDFlush();
+	test_expect_clear();
+	test_expect_glyph(0, 0, test_icons[0]);
+	test_expect_glyph(0, 1, test_icons[1]);
+	test_expect_glyph(0, 2, test_icons[2]);
+	test_screen("icons after the big digit");
+}
+
+/* ----------------------------------- FLASH STRINGS */
+static void test_scroll(const char *text)
+{
+	test_scroll_text = text;
+	test_scroll_shift = 0;
+	LCDScrollText_P(text);
+	test_scroll_text = 0;
+	test_checks++;
+	if(test_scroll_shift != strlen_P(text) + TEST_COLUMNS) test_fail("scroll", "wrong number of steps");
+	test_expect_clear();
+	test_screen("after the scroll");
+}
+
+static void test_flash_strings(void)
+{
+	LCDClear();
+	LCDFrameClear();
+	memset(LCD_shadow, ' ', sizeof(LCD_shadow));
+	LCDFrameGotoXY(1, 1);
+	LCDFrameWriteFormat_P(PSTR("%d|%d|%b%%|%d"), -123, 0, 0x42, 1234);
+	LCDFrameGotoXY(1, 2);
+	LCDFrameWriteString_P(PSTR("flash text that is too long"));
+	LCDFlush();
+	test_expect_clear();
+	test_expect_text(0, 0, "-123|0|42%|1234");
+	test_expect_text(1, 0, "flash text that ");
+	test_screen("format and flash string");
+
+	// Stops at the end of the frame, in the middle of a value too
+	LCDFrameClear();
+	LCDFrameGotoXY(LCD_NR_OF_CHARACTERS - 8, 2);
+	LCDFrameWriteFormat_P(PSTR("Left: %b:%b"), 0x12, 0x34);
+	LCDFlush();
+	test_expect_clear();
+	test_expect_text(1, LCD_NR_OF_CHARACTERS - 9, "Left: 12:");
+	test_screen("format at the end of the frame");
+
+	// Straight to the LCD: wraps to line 2 without the leading space
+	LCDClear();
+	LCDWriteStringXY_P(1, 1, PSTR("0123456789abcdef wrap%1"));
+	test_expect_clear();
+	test_expect_text(0, 0, "0123456789abcdef");
+	test_expect_text(1, 0, "wrap");
+	test_expect_glyph(1, 4, &LCD_custom_chars[1 * 8]);
+	test_screen("flash string wrapped");
+
+	// Shorter and longer than the hidden part of the line
+	test_scroll(PSTR("scroll"));
+	test_scroll(PSTR("ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"));
+	memset(LCD_shadow, ' ', sizeof(LCD_shadow));
+}
+
+/* ----------------------------------- COMPILE TIME FORMAT */
+static void test_printf(void)
+{
+	uint8_t hours = 7, minutes = 5, seconds = 59;
+
+	// toScreen() of feeder.c
+	LCDClear();
+	LCDFrameClear();
+	memset(LCD_shadow, ' ', sizeof(LCD_shadow));
+	LCDFrameGotoXY(1, 1);
+	LCDFramePrintf("Current:%b:%b:%b", 0x21, 0x35, 0x09);
+	LCDFrameGotoXY(2, 2);
+	LCDFramePrintf("Left: %b:%b:%b", 0x02, 0x24, 0x51);
+	LCDFlush();
+	test_expect_clear();
+	test_expect_text(0, 0, "Current:21:35:09");
+	test_expect_text(1, 1, "Left: 02:24:51");
+	test_screen("toScreen() layout");
+
+	LCDFrameClear();
+	LCDFramePrintf("Current:%02u:%02u:%02u", hours, minutes, seconds);
+	LCDFrameGotoXY(1, 2);
+	LCDFramePrintf("%5d|%05d|%u", -42, -42, 65535u);
+	LCDFlush();
+	test_expect_clear();
+	test_expect_text(0, 0, "Current:07:05:59");
+	test_expect_text(1, 0, "  -42|-0042|6553");
+	test_screen("padding, signs and clipping");
+
+	LCDFrameClear();
+	LCDFrameGotoXY(LCD_NR_OF_CHARACTERS - 4, 2);
+	LCDFramePrintf("%c%3u%%!", 'x', 100);
+	LCDFlush();
+	test_expect_clear();
+	test_expect_text(1, LCD_NR_OF_CHARACTERS - 5, "x100%");
+	test_screen("%c and %% at the end of the frame");
+
+	// Straight to the LCD, "%3" is text here. A string that ends in "%" stops there.
+	LCDClear();
+	LCDGotoXY(1, 1);
+	LCDPrintf("%3d%%3", 50);
+	LCDGotoXY(1, 2);
+	LCDWriteString("100%");
+	test_expect_clear();
+	test_expect_text(0, 0, " 50%3");
+	test_expect_text(1, 0, "100%");
+	test_screen("LCDPrintf");
+	memset(LCD_shadow, ' ', sizeof(LCD_shadow));
+}
+
+/* ----------------------------------- PAGES */
+static void test_pages(void)
+{
+	unsigned long bytes;
+
+	LCDClear();
+	LCDFrameClear();
+	memset(LCD_shadow, ' ', sizeof(LCD_shadow));
+	LCDFrameWriteStringXY(1, 1, "page one");
+	LCDFlush();
+	test_expect_clear();
+	test_expect_text(0, 0, "page one");
+	test_screen("page 0");
+
+	// Drawn on the hidden page, nothing changes until it is shown
+	LCDPageGotoXY(1, 3, 2);
+	LCDWriteString("hidden");
+	test_screen("page 1 while hidden");
+	bytes = sim_lcd_bytes();
+	LCDPageShow(1);
+	test_bytes("showing page 1", sim_lcd_bytes() - bytes, LCD_PAGE_OFFSET);
+	test_expect_clear();
+	test_expect_text(1, 2, "hidden");
+	test_screen("page 1");
+	bytes = sim_lcd_bytes();
+	LCDPageShow(0);
+	test_bytes("showing page 0", sim_lcd_bytes() - bytes, 1);
+	test_expect_clear();
+	test_expect_text(0, 0, "page one");
+	test_screen("page 0 again");
+
+	// The frame goes to the page on screen, or whole to the hidden one
+	LCDFrameClear();
+	LCDFrameWriteStringXY(1, 2, "page two");
+	LCDFlip();
+	test_expect_clear();
+	test_expect_text(1, 0, "page two");
+	test_screen("flip to page 1");
+	LCDFrameWriteStringXY(1, 1, "flush");
+	LCDFlush();
+	test_expect_text(0, 0, "flush");
+	test_screen("flush on page 1");
+	LCDFrameClear();
+	LCDFrameWriteStringXY(3, 1, "back");
+	LCDFlip();
+	test_expect_clear();
+	test_expect_text(0, 2, "back");
+	test_screen("flip to page 0");
+
+	test_checks++;
+	if(LCD_page != 0) test_fail("pages", "LCD_page is not 0 after two flips");
+	LCDClear();
+	memset(LCD_shadow, ' ', sizeof(LCD_shadow));
+}
+
+int main(void)
+{
+	LCDSetup(LCD_CURSOR_NONE);
+
+	test_big_digits();
+	test_glyphs();
+	test_flash_strings();
+	test_printf();
+	test_pages();
+
+	test_checks++;
+	if(sim_lcd_errors()) test_fail("timing", "bytes sent while busy or short E pulses");
+	printf("lcd_test: %d checks, %d failed\n", test_checks, test_failures);
+	return test_failures != 0;
+}
@@ -0,0 +1,1086 @@
+/*_______________________________________________________________________________
+sim.cpp - Virtual time host simulation of feeder.c and training.c
+
+The firmware is compiled for Linux with -DSIM against the headers in sim/ and
+linked with this file. Registers call into the device models below; sleeping,
+_delay_*() and HAL_WAIT() let virtual time run to the next event, so a day
+of firmware time takes a fraction of a second.
+
+What you see:
+- every LCD screen at the snapshot interval and at the end, rendered from an
+  HD44780 model driven by the E, RS, R/W and data pins
+- one line per motor move (coil pattern steps forward/back, time, bad steps),
+  or every coil pattern with -v
+- USART output, line by line
+- a summary: interrupts, sleep time per mode and per CPU clock, LCD and
+  EEPROM traffic, timing errors (LCD strobes shorter than 230 ns, USART bytes
+  off the terminal's 9600 baud)
+- the charge per day of each CPU clock and sleep mode, the LCD and the
+  coils, from the times above and datasheet currents (make power)
+
+USAGE
+-----
+	./feeder_sim [-d days | -t seconds] [-s seconds] [-b time[/ms]]...
+	             [-n] [-c time=text]... [-e file] [-r percent[,per_day]] [-v]
+
+	-d, -t	length of the run (default 1 day)
+	-s		LCD snapshot interval in seconds (default: only at the end)
+	-b		press the button (PB0) at "time" for "ms" (default 200 ms)
+	-n		add contact bounce to every press and release
+	-c		type "text" and Enter on the USART at "time"
+	-e		EEPROM image, loaded at start (if present) and saved at the end
+	-r		error of the internal RC oscillator at the factory OSCCAL in
+			percent, optionally drifting by "per_day" percent a day
+	-v		trace every coil pattern
+
+Times are virtual time since power up: seconds, HH:MM[:SS] or D+HH:MM[:SS].
+
+A firmware whose main() returns ends the run there, with main()'s return
+value as exit status. sim/lcd_test.c (make simtest) does that: it drives
+OnLCDLib.h and checks the LCD model through sim_lcd_ddram() and friends.
+__________________________________________________________________________________*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include <string>
+
+#include "sim.h"
+#include "avr/io.h"
+#include "avr/sleep.h"
+
+#define SIM_NEVER 1e30
+#define SIM_NS 1e9
+#define SIM_CRYSTAL_HZ 32768.0
+#define SIM_EEPROM_SIZE (E2END + 1)
+#define SIM_EEPROM_WRITE_NS 3.4e6
+#define SIM_LCD_NS 37e3 // Most instructions
+#define SIM_LCD_SLOW_NS 1.52e6 // Clear display and return home
+#define SIM_LCD_PULSE_NS 230 // Shortest E pulse
+#define SIM_BAUD 9600 // The terminal on the USART
+
+int sim_main(void); // The firmware's main(), renamed by hal.h
+
+#define SIM_WEAK_VECTOR(vector) extern "C" __attribute__((weak)) void vector(void) {}
+SIM_VECTORS(SIM_WEAK_VECTOR)
+
+static uint16_t regs[SIM_REGISTERS];
+static uint8_t inputs[3]; // Levels driven from outside on ports B, C, D
+static double now = 0, end_time = 86400 * SIM_NS;
+static double cpu_ns = SIM_NS / F_CPU;
+static uint8_t sleep_mode = SLEEP_MODE_IDLE;
+static double rc_error = 0, rc_drift = 0; // Internal RC oscillator error, and its change per second
+static double rc_next = SIM_NEVER; // Next update of a drifting RC clock
+static uint8_t frozen = 0; // Power-save: clocks derived from the CPU clock stop
+static int verbose = 0;
+static int exit_status = 0; // What the firmware's main() returned
+
+// Statistics
+static unsigned long interrupts[16];
+static const char *interrupt_names[16];
+static double sleep_time[16];
+static unsigned long wakeups = 0, frozen_timer1 = 0;
+
+// Energy budget. Code takes no virtual time, so each interrupt and each main
+// loop pass after a wake up is charged a number of cycles at the clock it
+// runs at, as time awake taken from the sleep it ended. Longer CPU work is
+// marked in the firmware with HAL_WORK() and takes virtual time. Currents are
+// ATmega328P datasheet typicals at 3 V, by CLKPR value (8 MHz >> value).
+#define SIM_ISR_CYCLES 50
+#define SIM_PASS_CYCLES 150
+#define SIM_POWER_SAVE_MA 0.0009 // Timer2 running from the crystal
+#define SIM_LCD_MA 1.2 // HD44780 logic, backlight not included
+#define SIM_COIL_MA 70.0 // One energized 28BYJ-48 coil
+static const double power_active_ma[9] = {3.2, 1.8, 0.95, 0.50, 0.29, 0.17, 0.09, 0.06, 0.045};
+static const double power_idle_ma[9] = {0.80, 0.45, 0.24, 0.12, 0.075, 0.045, 0.03, 0.022, 0.018};
+static double work_cycles[16]; // Charged cycles at each CLKPR value
+static double idle_clock_time[16], save_clock_time[16]; // Sleep at each CLKPR value, less the work
+
+static const char *sim_time(double t)
+{
+	static char text[32];
+	unsigned long ms = (unsigned long)(t / 1e6);
+	unsigned long s = ms / 1000;
+
+	snprintf(text, sizeof(text), "%lu+%02lu:%02lu:%02lu.%03lu", s / 86400, s / 3600 % 24, s / 60 % 60, s % 60, ms % 1000);
+	return text;
+}
+
+/* ----------------------------------- TIMER1, CTC or normal mode */
+static double t1_zero = 0; // Time TCNT1 was 0
+
+static double timer1_tick(void)
+{
+	static const int prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+	return cpu_ns * prescalers[regs[SIM_TCCR1B] & 0x07];
+}
+
+static double timer1_count(void)
+{
+	double tick = timer1_tick();
+	return tick ? floor((now - t1_zero) / tick + 1e-9) : regs[SIM_TCNT1];
+}
+
+static uint8_t timer1_ctc(void)
+{
+	return regs[SIM_TCCR1B] & (1 << WGM12);
+}
+
+// Next compare match (CTC) or overflow (normal mode, no compare match)
+static double timer1_next(void)
+{
+	double tick = timer1_tick();
+	double top = timer1_ctc() ? regs[SIM_OCR1A] : 0xFFFF;
+
+	if(!tick || frozen) return SIM_NEVER;
+	if(timer1_count() > top + 1) top += 0x10000; // Compare value moved below the count, wraps first
+	return t1_zero + (top + 1) * tick;
+}
+
+/* ----------------------------------- TIMER2, CTC or asynchronous normal mode */
+static double t2_zero = 0;
+static double t2_done = 0; // Asynchronous: last count whose events were handled
+
+static uint8_t timer2_async(void)
+{
+	return regs[SIM_ASSR] & (1 << AS2);
+}
+
+static double timer2_tick(void)
+{
+	static const int prescalers[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+	int prescaler = prescalers[regs[SIM_TCCR2B] & 0x07];
+	return (timer2_async() ? SIM_NS / SIM_CRYSTAL_HZ : cpu_ns) * prescaler;
+}
+
+static double timer2_count(void)
+{
+	double tick = timer2_tick();
+	return tick ? floor((now - t2_zero) / tick + 1e-9) : regs[SIM_TCNT2];
+}
+
+// Next event and which flags it sets
+static double timer2_next(uint8_t *flags)
+{
+	double tick = timer2_tick(), overflow, compare;
+	uint8_t ocr = regs[SIM_OCR2A];
+
+	*flags = 0;
+	if(!tick) return SIM_NEVER;
+	if(!timer2_async())
+	{
+		if(frozen) return SIM_NEVER;
+		*flags = (1 << OCF2A);
+		return t2_zero + (timer2_count() > ocr + 1 ? ocr + 0x101 : ocr + 1) * tick;
+	}
+
+	overflow = (floor(t2_done / 256) + 1) * 256;
+	compare = t2_done + ((ocr - (long)t2_done) & 0xFF);
+	if(compare <= t2_done) compare += 256;
+	if(overflow <= compare) *flags |= (1 << TOV2);
+	if(compare <= overflow) *flags |= (1 << OCF2A);
+	return t2_zero + (overflow < compare ? overflow : compare) * tick;
+}
+
+/* ----------------------------------- USART0 */
+static double tx_until = SIM_NEVER; // End of the byte in the shift register
+static uint8_t tx_shift, tx_buffer, tx_full = 0;
+static std::string tx_line;
+static std::string rx_queue;
+static double rx_next = SIM_NEVER;
+static uint8_t rx_data;
+
+struct sim_console_t
+{
+	double time;
+	std::string text;
+};
+static std::vector<sim_console_t> console_script;
+static size_t console_next = 0;
+
+static unsigned long usart_bytes = 0, usart_off_baud = 0;
+
+static double usart_byte_ns(void)
+{
+	int divider = (regs[SIM_UCSR0A] & (1 << U2X0)) ? 8 : 16;
+	return 10 * cpu_ns * divider * (regs[SIM_UBRR0] + 1);
+}
+
+// A byte at the firmware's baud rate, which must be within 2 % of the terminal's
+static void usart_check(uint8_t c)
+{
+	usart_bytes++;
+	if(fabs(usart_byte_ns() * SIM_BAUD / (10 * SIM_NS) - 1) <= 0.02) return;
+	if(usart_off_baud++ < 5)
+	{
+		printf("%s uart  byte 0x%02X at %.0f baud\n", sim_time(now), c, 10 * SIM_NS / usart_byte_ns());
+	}
+}
+
+static void usart_output(uint8_t c)
+{
+	if(c == '\n')
+	{
+		printf("%s uart  %s\n", sim_time(now), tx_line.c_str());
+		tx_line.clear();
+	}
+	else if(c != '\r')
+	{
+		tx_line += (c >= 0x20 && c < 0x7F) ? (char)c : '.';
+	}
+}
+
+static void usart_send(uint8_t c)
+{
+	if(!(regs[SIM_UCSR0B] & (1 << TXEN0))) return;
+	usart_check(c);
+	if(tx_until == SIM_NEVER)
+	{
+		tx_shift = c;
+		tx_until = now + usart_byte_ns();
+	}
+	else
+	{
+		tx_buffer = c;
+		tx_full = 1;
+	}
+}
+
+/* ----------------------------------- BUTTON AND OTHER INPUTS */
+struct sim_input_t
+{
+	double time;
+	uint8_t level;
+};
+static std::vector<sim_input_t> button_script;
+static size_t button_next = 0;
+static uint8_t button_bit = PB0;
+
+static void input_set(uint8_t level)
+{
+	uint8_t old = inputs[0];
+
+	if(level) inputs[0] |= (1 << button_bit);
+	else inputs[0] &= ~(1 << button_bit);
+	if((old ^ inputs[0]) & regs[SIM_PCMSK0] & ~regs[SIM_DDRB]) regs[SIM_PCIFR] |= (1 << PCIF0);
+}
+
+/* ----------------------------------- HD44780 */
+static uint8_t lcd_start = 2, lcd_rs = PD0, lcd_rw = PD1, lcd_e = PD2;
+static uint8_t lcd_eight_bit = 1, lcd_half = 0, lcd_high = 0;
+static uint8_t lcd_ddram[2][40], lcd_cgram[64];
+static uint8_t lcd_address = 0, lcd_cg = 0, lcd_increment = 1, lcd_display = 0, lcd_shift = 0;
+static double lcd_busy_until = 0, lcd_e_rise = 0;
+static unsigned long lcd_bytes = 0, lcd_violations = 0, lcd_short_pulses = 0;
+
+static void lcd_reset(void)
+{
+	memset(lcd_ddram, ' ', sizeof(lcd_ddram));
+	memset(lcd_cgram, 0, sizeof(lcd_cgram));
+}
+
+static void lcd_move(int direction)
+{
+	uint8_t line = lcd_address & 0x40, column = lcd_address & 0x3F;
+
+	if(direction > 0 && ++column >= 40)
+	{
+		column = 0;
+		line ^= 0x40;
+	}
+	else if(direction < 0 && column-- == 0)
+	{
+		column = 39;
+		line ^= 0x40;
+	}
+	lcd_address = line | column;
+}
+
+static void lcd_execute(uint8_t byte, uint8_t data)
+{
+	double busy = SIM_LCD_NS;
+
+	if(now < lcd_busy_until && lcd_violations++ < 5)
+	{
+		printf("%s lcd   byte 0x%02X sent while busy\n", sim_time(now), byte);
+	}
+	lcd_bytes++;
+
+	if(data)
+	{
+		if(lcd_cg) lcd_cgram[lcd_address++ & 0x3F] = byte;
+		else
+		{
+			lcd_ddram[lcd_address >> 6][(lcd_address & 0x3F) % 40] = byte;
+			lcd_move(lcd_increment ? 1 : -1);
+		}
+	}
+	else if(byte & 0x80)
+	{
+		lcd_cg = 0;
+		lcd_address = byte & 0x7F;
+	}
+	else if(byte & 0x40)
+	{
+		lcd_cg = 1;
+		lcd_address = byte & 0x3F;
+	}
+	else if(byte & 0x20)
+	{
+		lcd_eight_bit = (byte >> 4) & 1;
+		lcd_half = 0;
+	}
+	else if(byte & 0x10)
+	{
+		int direction = (byte & 0x04) ? 1 : -1;
+		if(byte & 0x08) lcd_shift = (lcd_shift + 40 - direction) % 40;
+		else lcd_move(direction);
+	}
+	else if(byte & 0x08) lcd_display = byte & 0x04;
+	else if(byte & 0x04) lcd_increment = (byte >> 1) & 1;
+	else if(byte & 0x02)
+	{
+		lcd_address = 0;
+		lcd_shift = 0;
+		lcd_cg = 0;
+		busy = SIM_LCD_SLOW_NS;
+	}
+	else if(byte & 0x01)
+	{
+		memset(lcd_ddram, ' ', sizeof(lcd_ddram));
+		lcd_address = 0;
+		lcd_shift = 0;
+		lcd_cg = 0;
+		lcd_increment = 1;
+		busy = SIM_LCD_SLOW_NS;
+	}
+	lcd_busy_until = now + busy;
+}
+
+// Falling edge of E
+static void lcd_strobe(void)
+{
+	if(now - lcd_e_rise < SIM_LCD_PULSE_NS && lcd_short_pulses++ < 5)
+	{
+		printf("%s lcd   E pulse of %.0f ns\n", sim_time(now), now - lcd_e_rise);
+	}
+
+	uint8_t nibble = (regs[SIM_PORTC] >> lcd_start) & 0x0F;
+	uint8_t data = (regs[SIM_PORTD] >> lcd_rs) & 1;
+
+	if((regs[SIM_PORTD] >> lcd_rw) & 1) return; // Busy flag read
+	if(lcd_eight_bit)
+	{
+		lcd_execute(nibble << 4, data); // Only DB4..DB7 are wired
+		return;
+	}
+	if(!lcd_half)
+	{
+		lcd_high = nibble;
+		lcd_half = 1;
+		return;
+	}
+	lcd_half = 0;
+	lcd_execute((lcd_high << 4) | nibble, data);
+}
+
+static void lcd_print(void)
+{
+	int row, column;
+
+	for(row = 0; row < 2; row++)
+	{
+		printf("%s lcd   |", row ? "                " : sim_time(now));
+		for(column = 0; column < 16; column++)
+		{
+			uint8_t c = lcd_ddram[row][(column + lcd_shift) % 40];
+			putchar(!lcd_display ? ' ' : c < 8 ? '#' : (c >= 0x20 && c < 0x7F) ? c : '?');
+		}
+		printf("|\n");
+	}
+}
+
+// Read back by the LCD checks (sim/lcd_test.c)
+uint8_t sim_lcd_ddram(uint8_t line, uint8_t column)
+{
+	return lcd_ddram[line & 1][column % 40];
+}
+
+uint8_t sim_lcd_screen(uint8_t row, uint8_t column)
+{
+	return lcd_ddram[row & 1][(column + lcd_shift) % 40];
+}
+
+uint8_t sim_lcd_cgram(uint8_t address)
+{
+	return lcd_cgram[address & 0x3F];
+}
+
+unsigned long sim_lcd_bytes(void)
+{
+	return lcd_bytes;
+}
+
+unsigned long sim_lcd_errors(void)
+{
+	return lcd_violations + lcd_short_pulses;
+}
+
+/* ----------------------------------- STEPPER COILS */
+// A move ends when the coils stay off for SIM_COIL_OFF_NS. Until then,
+// switching the same pattern on again is chopping (motor.h hold), not a step.
+#define SIM_COIL_OFF_NS 5e6
+
+static uint8_t coil_masks[4] = {1 << PB5, 1 << PB4, 1 << PB3, 1 << PB2};
+static uint8_t coil_pattern = 0, coil_last = 0; // Last pattern that was not off
+static int coil_phase = -1;
+static unsigned long coil_forward = 0, coil_back = 0, coil_bad = 0, coil_total = 0;
+static double coil_start = 0, coil_step_at = 0, coil_on_since = 0, coil_hold_on = 0, coil_off_at = 0;
+static double coil_report_at = SIM_NEVER;
+static double coil_on = 0; // Time each coil was energized, added up
+
+static uint8_t coils(void)
+{
+	uint8_t pattern = 0, i;
+
+	for(i = 0; i < 4; i++) if(regs[SIM_PORTB] & regs[SIM_DDRB] & coil_masks[i]) pattern |= 8 >> i;
+	return pattern;
+}
+
+static void coils_report(void)
+{
+	double hold = coil_off_at - coil_step_at;
+
+	printf("%s motor %lu forward, %lu back, %.3f s, held %.3f s at %.0f%%, %lu bad\n", sim_time(coil_off_at),
+		coil_forward, coil_back, (coil_step_at - coil_start) / SIM_NS, hold / SIM_NS,
+		hold > 0 ? 100 * coil_hold_on / hold : 0.0, coil_bad);
+	coil_total += coil_forward + coil_back;
+	coil_forward = coil_back = coil_bad = 0;
+	coil_last = 0;
+	coil_report_at = SIM_NEVER;
+}
+
+static void coils_changed(void)
+{
+	static const uint8_t phases[8] = {0x8, 0xC, 0x4, 0x6, 0x2, 0x3, 0x1, 0x9}; // M0 M1 M2 M3
+	uint8_t pattern = coils();
+	int phase = -1, i, delta;
+
+	if(pattern == coil_pattern) return;
+	if(verbose) printf("%s coils %d%d%d%d\n", sim_time(now), pattern >> 3, (pattern >> 2) & 1, (pattern >> 1) & 1, pattern & 1);
+
+	if(coil_pattern)
+	{
+		coil_hold_on += now - coil_on_since;
+		coil_on += (now - coil_on_since) * __builtin_popcount(coil_pattern);
+	}
+	coil_pattern = pattern;
+	if(!pattern)
+	{
+		coil_off_at = now;
+		coil_report_at = now + SIM_COIL_OFF_NS;
+		return;
+	}
+	coil_on_since = now;
+	coil_report_at = SIM_NEVER;
+	if(pattern == coil_last) return; // Chopped
+
+	for(i = 0; i < 8; i++) if(phases[i] == pattern) phase = i;
+	if(!coil_last) coil_start = now;
+	else
+	{
+		delta = (phase - coil_phase + 8) % 8;
+		if(phase < 0 || coil_phase < 0 || delta == 0 || delta == 4) coil_bad++;
+		else if(delta < 4) coil_forward++;
+		else coil_back++;
+	}
+	coil_last = pattern;
+	coil_phase = phase;
+	coil_step_at = now;
+	coil_hold_on = 0;
+}
+
+/* ----------------------------------- EEPROM */
+static uint8_t eeprom[SIM_EEPROM_SIZE];
+static unsigned long eeprom_writes[SIM_EEPROM_SIZE];
+static double eeprom_busy_until = 0;
+static const char *eeprom_file = NULL;
+
+uint8_t sim_eeprom_ready(void)
+{
+	return now >= eeprom_busy_until;
+}
+
+uint8_t sim_eeprom_read(uint16_t address)
+{
+	if(!sim_eeprom_ready()) sim_delay_ns(eeprom_busy_until - now);
+	return eeprom[address % SIM_EEPROM_SIZE];
+}
+
+void sim_eeprom_write(uint16_t address, uint8_t value)
+{
+	if(!sim_eeprom_ready()) sim_delay_ns(eeprom_busy_until - now);
+	eeprom[address % SIM_EEPROM_SIZE] = value;
+	eeprom_writes[address % SIM_EEPROM_SIZE]++;
+	eeprom_busy_until = now + SIM_EEPROM_WRITE_NS;
+}
+
+/* ----------------------------------- CPU CLOCK */
+// The 8 MHz RC oscillator, divided by CLKPR (8 at reset, CKDIV8) down to
+// F_CPU. Each OSCCAL step is about SIM_OSCCAL_STEP of the frequency, the
+// factory value makes it exact.
+#define SIM_CLKPR_RESET 3
+#define SIM_OSCCAL_FACTORY 0x94
+#define SIM_OSCCAL_STEP 0.004
+
+static double clock_time[16]; // Time spent at each CLKPR value
+static double clock_since = 0;
+static double clock_enable_until = -1; // CLKPR takes a value 4 cycles after CLKPCE
+
+static double sim_rc_hz(void)
+{
+	return F_CPU * (1 << SIM_CLKPR_RESET) * (1 + rc_error)
+		* (1 + SIM_OSCCAL_STEP * ((int)regs[SIM_OSCCAL] - SIM_OSCCAL_FACTORY));
+}
+
+// Timers clocked from the CPU keep their count across a clock change
+static void sim_clock_changed(void)
+{
+	double count1 = timer1_count(), count2 = timer2_count();
+
+	cpu_ns = SIM_NS / sim_rc_hz() * (1 << regs[SIM_CLKPR]);
+	if(timer1_tick()) t1_zero = now - count1 * timer1_tick();
+	if(timer2_tick() && !timer2_async()) t2_zero = now - count2 * timer2_tick();
+}
+
+/* ----------------------------------- REGISTERS */
+uint16_t sim_read(uint8_t reg)
+{
+	uint8_t value;
+
+	switch(reg)
+	{
+		case SIM_PINB: return (regs[SIM_PORTB] & regs[SIM_DDRB]) | (inputs[0] & ~regs[SIM_DDRB]);
+		case SIM_PINC:
+			value = inputs[1];
+			// The LCD drives DB7 with the busy flag while E is high in read mode
+			if(((regs[SIM_PORTD] >> lcd_rw) & 1) && ((regs[SIM_PORTD] >> lcd_e) & 1) && now < lcd_busy_until)
+			{
+				value |= 1 << (lcd_start + 3);
+			}
+			return (regs[SIM_PORTC] & regs[SIM_DDRC]) | (value & ~regs[SIM_DDRC]);
+		case SIM_PIND: return (regs[SIM_PORTD] & regs[SIM_DDRD]) | (inputs[2] & ~regs[SIM_DDRD]);
+		case SIM_TCNT1: return (uint16_t)fmod(timer1_count(), 0x10000);
+		case SIM_TCNT2: return (uint8_t)fmod(timer2_count(), 0x100);
+		case SIM_ASSR: return regs[reg] & ~0x1F; // Updates are never pending
+		case SIM_UCSR0A: return (regs[reg] & ~(1 << UDRE0)) | (tx_full ? 0 : (1 << UDRE0));
+		case SIM_UDR0:
+			regs[SIM_UCSR0A] &= ~(1 << RXC0);
+			return rx_data;
+		default: return regs[reg];
+	}
+}
+
+void sim_write(uint8_t reg, uint16_t value)
+{
+	uint8_t old = regs[reg];
+	double count;
+
+	switch(reg)
+	{
+		case SIM_PINB: case SIM_PINC: case SIM_PIND:
+			sim_write(reg + 2, regs[reg + 2] ^ value); // Toggle PORTx
+			return;
+		case SIM_TIFR0: case SIM_TIFR1: case SIM_TIFR2: case SIM_PCIFR:
+			regs[reg] &= ~value; // Writing one clears a flag
+			return;
+		case SIM_TCCR1B:
+			count = timer1_count();
+			regs[reg] = value;
+			if(timer1_tick()) t1_zero = now - count * timer1_tick();
+			return;
+		case SIM_TCNT1:
+			regs[reg] = value;
+			if(timer1_tick()) t1_zero = now - value * timer1_tick();
+			return;
+		case SIM_TCCR2B: case SIM_ASSR:
+			regs[reg] = value;
+			if(reg == SIM_ASSR && ((old ^ value) & (1 << AS2))) regs[SIM_TCNT2] = 0;
+			count = reg == SIM_ASSR ? 0 : timer2_count();
+			if(timer2_tick()) t2_zero = now - count * timer2_tick();
+			t2_done = count;
+			return;
+		case SIM_TCNT2:
+			regs[reg] = value;
+			if(timer2_tick()) t2_zero = now - value * timer2_tick();
+			t2_done = value;
+			return;
+		case SIM_UDR0:
+			usart_send(value);
+			return;
+		case SIM_CLKPR:
+			if(value & (1 << CLKPCE))
+			{
+				clock_enable_until = now + 4 * cpu_ns;
+				return;
+			}
+			if(now > clock_enable_until) return; // Not enabled, ignored
+			clock_enable_until = -1;
+			clock_time[regs[reg]] += now - clock_since;
+			clock_since = now;
+			regs[reg] = value & 0x0F;
+			sim_clock_changed();
+			return;
+		case SIM_OSCCAL:
+			regs[reg] = value;
+			sim_clock_changed();
+			return;
+	}
+
+	regs[reg] = value;
+	if(reg == SIM_PORTB || reg == SIM_DDRB) coils_changed();
+	if(reg == SIM_PORTD && !((old >> lcd_e) & 1) && ((value >> lcd_e) & 1)) lcd_e_rise = now;
+	if(reg == SIM_PORTD && ((old >> lcd_e) & 1) && !((value >> lcd_e) & 1)) lcd_strobe();
+}
+
+void sim_lcd_wiring(uint8_t data_start, uint8_t rs, uint8_t rw, uint8_t e)
+{
+	lcd_start = data_start;
+	lcd_rs = rs;
+	lcd_rw = rw;
+	lcd_e = e;
+}
+
+void sim_motor_wiring(uint8_t m0, uint8_t m1, uint8_t m2, uint8_t m3)
+{
+	coil_masks[0] = m0;
+	coil_masks[1] = m1;
+	coil_masks[2] = m2;
+	coil_masks[3] = m3;
+}
+
+/* ----------------------------------- INTERRUPTS AND TIME */
+void sim_cli(void)
+{
+	regs[SIM_SREG] &= ~0x80;
+}
+
+void sim_sei(void)
+{
+	regs[SIM_SREG] |= 0x80;
+}
+
+static void sim_finish(void);
+
+static void sim_call(int number, const char *name, void (*vector)(void))
+{
+	work_cycles[regs[SIM_CLKPR]] += SIM_ISR_CYCLES;
+	interrupts[number]++;
+	interrupt_names[number] = name;
+	sim_cli();
+	vector();
+	sim_sei();
+}
+
+// Runs every pending interrupt in priority order, returns 1 if any ran
+static uint8_t sim_dispatch(void)
+{
+	uint8_t ran = 0;
+
+	while(regs[SIM_SREG] & 0x80)
+	{
+		uint16_t *tifr2 = &regs[SIM_TIFR2], *tifr1 = &regs[SIM_TIFR1];
+
+		if((regs[SIM_PCIFR] & (1 << PCIF0)) && (regs[SIM_PCICR] & (1 << PCIE0)))
+		{
+			regs[SIM_PCIFR] &= ~(1 << PCIF0);
+			sim_call(0, "PCINT0", PCINT0_vect);
+		}
+		else if((*tifr2 & (1 << OCF2A)) && (regs[SIM_TIMSK2] & (1 << OCIE2A)))
+		{
+			*tifr2 &= ~(1 << OCF2A);
+			sim_call(1, "TIMER2_COMPA", TIMER2_COMPA_vect);
+		}
+		else if((*tifr2 & (1 << TOV2)) && (regs[SIM_TIMSK2] & (1 << TOIE2)))
+		{
+			*tifr2 &= ~(1 << TOV2);
+			sim_call(2, "TIMER2_OVF", TIMER2_OVF_vect);
+		}
+		else if((*tifr1 & (1 << OCF1A)) && (regs[SIM_TIMSK1] & (1 << OCIE1A)))
+		{
+			*tifr1 &= ~(1 << OCF1A);
+			sim_call(3, "TIMER1_COMPA", TIMER1_COMPA_vect);
+		}
+		else if((regs[SIM_UCSR0A] & (1 << RXC0)) && (regs[SIM_UCSR0B] & (1 << RXCIE0)))
+		{
+			sim_call(4, "USART_RX", USART_RX_vect);
+		}
+		else if(!tx_full && (regs[SIM_UCSR0B] & (1 << UDRIE0)))
+		{
+			sim_call(5, "USART_UDRE", USART_UDRE_vect);
+		}
+		else break;
+		ran = 1;
+	}
+	return ran;
+}
+
+// Earliest pending event, returns its time
+static double sim_next_event(void)
+{
+	double t = end_time, next;
+	uint8_t flags;
+
+	if((next = timer1_next()) < t) t = next;
+	if((next = timer2_next(&flags)) < t) t = next;
+	if(!frozen && tx_until < t) t = tx_until;
+	if(!frozen && rx_next < t) t = rx_next;
+	if(button_next < button_script.size() && button_script[button_next].time < t) t = button_script[button_next].time;
+	if(console_next < console_script.size() && console_script[console_next].time < t) t = console_script[console_next].time;
+	if(coil_report_at < t) t = coil_report_at;
+	if(rc_next < t) t = rc_next;
+	return t;
+}
+
+static double snapshot_interval = 0, snapshot_next = SIM_NEVER;
+
+// Handles everything due at "now"
+static void sim_events(void)
+{
+	uint8_t flags;
+
+	if(now >= end_time) sim_finish();
+
+	if(timer1_next() <= now)
+	{
+		regs[SIM_TIFR1] |= timer1_ctc() ? (1 << OCF1A) : (1 << TOV1);
+		t1_zero = timer1_next();
+	}
+	if(timer2_next(&flags) <= now)
+	{
+		regs[SIM_TIFR2] |= flags;
+		if(timer2_async()) t2_done = floor((now - t2_zero) / timer2_tick() + 0.5);
+		else t2_zero = now;
+	}
+	if(!frozen && tx_until <= now)
+	{
+		usart_output(tx_shift);
+		regs[SIM_UCSR0A] |= (1 << TXC0);
+		tx_until = SIM_NEVER;
+		if(tx_full)
+		{
+			tx_shift = tx_buffer;
+			tx_full = 0;
+			tx_until = now + usart_byte_ns();
+		}
+	}
+	if(!frozen && rx_next <= now)
+	{
+		if(regs[SIM_UCSR0B] & (1 << RXEN0))
+		{
+			rx_data = rx_queue[0];
+			regs[SIM_UCSR0A] |= (1 << RXC0);
+			usart_check(rx_data);
+		}
+		rx_queue.erase(0, 1);
+		rx_next = rx_queue.empty() ? SIM_NEVER : now + 10 * SIM_NS / SIM_BAUD;
+	}
+	while(button_next < button_script.size() && button_script[button_next].time <= now)
+	{
+		input_set(button_script[button_next++].level);
+	}
+	while(console_next < console_script.size() && console_script[console_next].time <= now)
+	{
+		if(rx_queue.empty()) rx_next = now + 10 * SIM_NS / SIM_BAUD;
+		rx_queue += console_script[console_next++].text + "\r";
+	}
+	if(coil_report_at <= now) coils_report();
+	if(rc_next <= now)
+	{
+		rc_error += rc_drift * 60;
+		rc_next += 60 * SIM_NS;
+		sim_clock_changed();
+	}
+	while(snapshot_next <= now)
+	{
+		lcd_print();
+		snapshot_next += snapshot_interval;
+	}
+}
+
+// Lets time run to "until", or to the first interrupt if "wake" is set
+static void sim_run(double until, uint8_t wake)
+{
+	double t;
+
+	if(sim_dispatch() && wake) return;
+	while(1)
+	{
+		t = sim_next_event();
+		if(snapshot_next < t) t = snapshot_next;
+		if(t > until)
+		{
+			now = until;
+			return;
+		}
+		now = t;
+		sim_events();
+		if(sim_dispatch() && wake) return;
+	}
+}
+
+void sim_sleep_mode(uint8_t mode)
+{
+	sleep_mode = mode;
+}
+
+void sim_sleep(void)
+{
+	double start = now, work, slept;
+	uint8_t mode = sleep_mode & 0x0E, clock = regs[SIM_CLKPR];
+	double cycles = work_cycles[clock];
+
+	wakeups++;
+	frozen = mode != SLEEP_MODE_IDLE && mode != SLEEP_MODE_ADC;
+	if(frozen && timer1_tick() && (regs[SIM_TIMSK1] & (1 << OCIE1A))) frozen_timer1++;
+
+	sim_run(SIM_NEVER, 1);
+
+	if(frozen)
+	{
+		// Clocks derived from the CPU clock did not run
+		t1_zero += now - start;
+		if(!timer2_async()) t2_zero += now - start;
+		if(tx_until != SIM_NEVER) tx_until += now - start;
+		if(rx_next != SIM_NEVER) rx_next += now - start;
+		frozen = 0;
+	}
+	sleep_time[mode] += now - start;
+
+	// The interrupts that woke the CPU and the loop pass after them
+	work_cycles[clock] += SIM_PASS_CYCLES;
+	work = (work_cycles[clock] - cycles) * SIM_NS * (1 << clock) / (F_CPU << SIM_CLKPR_RESET);
+	slept = std::max(now - start - work, 0.0);
+	if(mode == SLEEP_MODE_IDLE) idle_clock_time[clock] += slept;
+	else save_clock_time[clock] += slept;
+}
+
+void sim_delay_ns(double ns)
+{
+	sim_run(now + ns, 0);
+}
+
+void sim_cycles(double cycles)
+{
+	sim_run(now + cycles * cpu_ns, 0);
+}
+
+void sim_wait(void)
+{
+	sim_run(SIM_NEVER, 1);
+}
+
+/* ----------------------------------- SETUP AND REPORT */
+// Charge per day in each state, scaled up from the length of the run
+static void power_report(void)
+{
+	double day = 86400 * SIM_NS / end_time, mah = 1 / SIM_NS / 3600;
+	double total = 0, awake = 0, asleep = 0, charge;
+	int i;
+
+	printf("energy per day at 3 V (%d cycles an interrupt, %d a loop pass):\n", SIM_ISR_CYCLES, SIM_PASS_CYCLES);
+	for(i = 0; i < 9; i++)
+	{
+		awake = clock_time[i] - idle_clock_time[i] - save_clock_time[i];
+		if(awake <= 0 && idle_clock_time[i] <= 0) continue;
+		charge = (awake * power_active_ma[i] + idle_clock_time[i] * power_idle_ma[i]) * day * mah;
+		printf("  %6g kHz  active %9.3f s  idle %9.1f s  %8.3f mAh\n", (double)(F_CPU << SIM_CLKPR_RESET) / (1 << i) / 1e3,
+			awake * day / SIM_NS, idle_clock_time[i] * day / SIM_NS, charge);
+		total += charge;
+		asleep += save_clock_time[i];
+	}
+	charge = asleep * SIM_POWER_SAVE_MA * day * mah;
+	printf("  power-save %9.1f s  %8.3f mAh\n", asleep * day / SIM_NS, charge);
+	total += charge;
+	charge = end_time * SIM_LCD_MA * day * mah;
+	printf("  lcd logic  %9.1f s  %8.3f mAh\n", end_time * day / SIM_NS, charge);
+	total += charge;
+	charge = coil_on * SIM_COIL_MA * day * mah;
+	printf("  coils      %9.2f coil s  %8.3f mAh\n", coil_on * day / SIM_NS, charge);
+	total += charge;
+	printf("  total %.3f mAh, %.0f uA average; never sleeping at %g kHz the MCU alone takes %.3f mAh\n",
+		total, total / 24 * 1000, F_CPU / 1e3, power_active_ma[SIM_CLKPR_RESET] * 24);
+}
+
+static void sim_finish(void)
+{
+	unsigned long max_writes = 0, total_writes = 0;
+	int i;
+	FILE *file;
+
+	now = end_time;
+	if(!tx_line.empty()) usart_output('\n');
+	if(coil_report_at != SIM_NEVER) coils_report();
+	if(coil_pattern)
+	{
+		printf("%s motor coils still on\n", sim_time(now));
+		coil_on += (now - coil_on_since) * __builtin_popcount(coil_pattern);
+	}
+	lcd_print();
+
+	for(i = 0; i < SIM_EEPROM_SIZE; i++)
+	{
+		total_writes += eeprom_writes[i];
+		if(eeprom_writes[i] > max_writes) max_writes = eeprom_writes[i];
+	}
+
+	printf("\n%.0f s simulated in %.2f s\n", end_time / SIM_NS, (double)clock() / CLOCKS_PER_SEC);
+	printf("wake ups %lu, idle %.1f s, power-save %.1f s\n", wakeups, sleep_time[SLEEP_MODE_IDLE] / SIM_NS,
+		sleep_time[SLEEP_MODE_PWR_SAVE] / SIM_NS);
+	for(i = 0; i < 16; i++) if(interrupts[i]) printf("%-13s %lu\n", interrupt_names[i], interrupts[i]);
+	printf("lcd bytes %lu, sent while busy %lu\n", lcd_bytes, lcd_violations);
+	printf("motor steps %lu, power-save with Timer1 running %lu\n", coil_total, frozen_timer1);
+	printf("eeprom writes %lu, most writes to one cell %lu\n", total_writes, max_writes);
+	if(usart_bytes) printf("uart bytes %lu, off baud %lu\n", usart_bytes, usart_off_baud);
+	printf("lcd E pulses shorter than %d ns %lu\n", SIM_LCD_PULSE_NS, lcd_short_pulses);
+	printf("cpu clock %+.3f %% (OSCCAL 0x%02X)", (sim_rc_hz() / (F_CPU << SIM_CLKPR_RESET) - 1) * 100, regs[SIM_OSCCAL]);
+	clock_time[regs[SIM_CLKPR]] += now - clock_since;
+	for(i = 0; i < 9; i++)
+	{
+		if(clock_time[i] > 0) printf(", %g kHz %.3f s", (double)(F_CPU << SIM_CLKPR_RESET) / (1 << i) / 1e3, clock_time[i] / SIM_NS);
+	}
+	printf("\n");
+	power_report();
+
+	if(eeprom_file && (file = fopen(eeprom_file, "wb")))
+	{
+		fwrite(eeprom, 1, sizeof(eeprom), file);
+		fclose(file);
+	}
+	fflush(stdout);
+	exit(exit_status);
+}
+
+// Seconds, HH:MM[:SS[.mmm]] or D+HH:MM[:SS[.mmm]]
+static double sim_parse_time(const char *text)
+{
+	double days = 0, h = 0, m = 0, s = 0;
+	const char *plus = strchr(text, '+');
+
+	if(plus)
+	{
+		days = atof(text);
+		text = plus + 1;
+	}
+	if(!strchr(text, ':')) return (days * 86400 + atof(text)) * SIM_NS;
+	sscanf(text, "%lf:%lf:%lf", &h, &m, &s);
+	return (days * 86400 + h * 3600 + m * 60 + s) * SIM_NS;
+}
+
+static void sim_press(double time, double hold, uint8_t bounce)
+{
+	static const double bounces[] = {0.3e6, 0.8e6, 1.5e6, 2.5e6}; // Ends on the new level
+	sim_input_t edge;
+	int level, i;
+
+	for(level = 1; level >= 0; level--)
+	{
+		edge.time = level ? time : time + hold;
+		edge.level = level;
+		button_script.push_back(edge);
+		for(i = 0; bounce && i < 4; i++)
+		{
+			edge.time += bounces[i] - (i ? bounces[i - 1] : 0);
+			edge.level = (i & 1) ? level : !level;
+			button_script.push_back(edge);
+		}
+	}
+}
+
+static void sim_usage(void)
+{
+	fprintf(stderr, "usage: sim [-d days | -t seconds] [-s seconds] [-b time[/ms]]... [-n]\n"
+		"           [-c time=text]... [-e eeprom_file] [-r percent[,per_day]] [-v]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::pair<double, double> > presses;
+	uint8_t bounce = 0;
+	int i;
+	FILE *file;
+
+	memset(eeprom, 0xFF, sizeof(eeprom)); // Erased
+	lcd_reset();
+
+	for(i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i], *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if(!strcmp(arg, "-n")) { bounce = 1; continue; }
+		if(!strcmp(arg, "-v")) { verbose = 1; continue; }
+		if(!value || arg[0] != '-') sim_usage();
+		i++;
+
+		switch(arg[1])
+		{
+			case 'd': end_time = atof(value) * 86400 * SIM_NS; break;
+			case 't': end_time = atof(value) * SIM_NS; break;
+			case 's': snapshot_interval = atof(value) * SIM_NS; break;
+			case 'e': eeprom_file = value; break;
+			case 'r':
+			{
+				const char *comma = strchr(value, ',');
+				rc_error = atof(value) / 100;
+				if(comma) rc_drift = atof(comma + 1) / 100 / 86400;
+				break;
+			}
+			case 'b':
+			{
+				const char *slash = strchr(value, '/');
+				presses.push_back(std::make_pair(sim_parse_time(value), slash ? atof(slash + 1) * 1e6 : 200e6));
+				break;
+			}
+			case 'c':
+			{
+				const char *equals = strchr(value, '=');
+				sim_console_t line;
+				if(!equals) sim_usage();
+				line.time = sim_parse_time(std::string(value, equals - value).c_str()); // "text" may hold a ':'
+				line.text = equals + 1;
+				console_script.push_back(line);
+				break;
+			}
+			default: sim_usage();
+		}
+	}
+
+	for(i = 0; i < (int)presses.size(); i++) sim_press(presses[i].first, presses[i].second, bounce);
+	std::stable_sort(button_script.begin(), button_script.end(),
+		[](const sim_input_t &a, const sim_input_t &b) { return a.time < b.time; });
+	std::stable_sort(console_script.begin(), console_script.end(),
+		[](const sim_console_t &a, const sim_console_t &b) { return a.time < b.time; });
+	if(snapshot_interval > 0) snapshot_next = snapshot_interval;
+
+	if(eeprom_file && (file = fopen(eeprom_file, "rb")))
+	{
+		if(fread(eeprom, 1, sizeof(eeprom), file) != sizeof(eeprom)) fprintf(stderr, "%s: short EEPROM image\n", eeprom_file);
+		fclose(file);
+	}
+
+	regs[SIM_MCUSR] = (1 << PORF);
+	regs[SIM_OSCCAL] = SIM_OSCCAL_FACTORY;
+	regs[SIM_CLKPR] = SIM_CLKPR_RESET;
+	sim_clock_changed();
+	if(rc_drift) rc_next = 60 * SIM_NS;
+	regs[SIM_UCSR0A] = (1 << UDRE0);
+	exit_status = sim_main();
+	end_time = now; // main() returned before the end of the run
+	sim_finish();
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*_______________________________________________________________________________
+sim.h - Host simulation of the ATmega328P peripherals used by the feeder
+
+Registers are small objects: reading or writing one calls sim_read() or
+sim_write(), which keep the device models in sim.cpp up to date. The firmware
+sources compile unchanged as C++ against this file (through the avr/ and util/
+headers next to it).
+
+Only what the firmware uses is modelled:
+- PORTB/C/D, DDRx, PINx (writing PINx toggles PORTx)
+- Timer1 in CTC or normal mode, Timer2 in CTC mode or asynchronous from a
+  32.768 kHz crystal in normal mode, Timer0 registers (not run)
+- the CPU clock from the internal RC oscillator: OSCCAL, CLKPR and a
+  factory error that can drift (sim -r)
+- pin change interrupt 0, USART0, EEPROM with its write time
+- sleep modes: Timer1, the USART and a synchronous Timer2 stop in power-save
+Interrupt service routines take no virtual time.
+__________________________________________________________________________________*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#ifndef __cplusplus
+#error "The simulation is built as C++, use make sim"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum
+{
+	SIM_PINB, SIM_DDRB, SIM_PORTB,
+	SIM_PINC, SIM_DDRC, SIM_PORTC,
+	SIM_PIND, SIM_DDRD, SIM_PORTD,
+	SIM_TCCR0A, SIM_TCCR0B, SIM_TCNT0, SIM_OCR0A, SIM_OCR0B, SIM_TIMSK0, SIM_TIFR0,
+	SIM_TCCR1A, SIM_TCCR1B, SIM_TCNT1, SIM_OCR1A, SIM_OCR1B, SIM_TIMSK1, SIM_TIFR1,
+	SIM_TCCR2A, SIM_TCCR2B, SIM_TCNT2, SIM_OCR2A, SIM_OCR2B, SIM_TIMSK2, SIM_TIFR2, SIM_ASSR,
+	SIM_PCICR, SIM_PCIFR, SIM_PCMSK0, SIM_PCMSK1, SIM_PCMSK2,
+	SIM_UBRR0, SIM_UCSR0A, SIM_UCSR0B, SIM_UCSR0C, SIM_UDR0,
+	SIM_MCUSR, SIM_SREG, SIM_SMCR, SIM_CLKPR, SIM_OSCCAL, SIM_WDTCSR, SIM_PRR,
+	SIM_REGISTERS
+};
+
+uint16_t sim_read(uint8_t reg);
+void sim_write(uint8_t reg, uint16_t value);
+
+template <uint8_t REG, typename T> struct sim_register
+{
+	operator T() const { return (T)sim_read(REG); }
+	sim_register &operator=(unsigned value) { sim_write(REG, (T)value); return *this; }
+	sim_register &operator|=(unsigned value) { sim_write(REG, (T)(sim_read(REG) | value)); return *this; }
+	sim_register &operator&=(unsigned value) { sim_write(REG, (T)(sim_read(REG) & value)); return *this; }
+	sim_register &operator^=(unsigned value) { sim_write(REG, (T)(sim_read(REG) ^ value)); return *this; }
+	sim_register &operator++() { sim_write(REG, (T)(sim_read(REG) + 1)); return *this; }
+	sim_register &operator--() { sim_write(REG, (T)(sim_read(REG) - 1)); return *this; }
+	T operator++(int) { T old = sim_read(REG); sim_write(REG, (T)(old + 1)); return old; }
+	T operator--(int) { T old = sim_read(REG); sim_write(REG, (T)(old - 1)); return old; }
+};
+
+// Interrupt vectors, defined by ISR() in the firmware (weak defaults in sim.cpp)
+#define SIM_VECTORS(X) \
+	X(PCINT0_vect) X(TIMER2_COMPA_vect) X(TIMER2_COMPB_vect) X(TIMER2_OVF_vect) \
+	X(TIMER1_COMPA_vect) X(TIMER1_OVF_vect) X(TIMER0_COMPA_vect) X(TIMER0_OVF_vect) \
+	X(USART_RX_vect) X(USART_UDRE_vect) X(USART_TX_vect) X(EE_READY_vect) X(WDT_vect)
+
+#define SIM_DECLARE_VECTOR(vector) extern "C" void vector(void);
+SIM_VECTORS(SIM_DECLARE_VECTOR)
+
+void sim_cli(void);
+void sim_sei(void);
+void sim_sleep_mode(uint8_t mode);
+void sim_sleep(void);
+void sim_delay_ns(double ns);
+void sim_wait(void);
+void sim_cycles(double cycles); // CPU cycles at the current clock
+
+void sim_lcd_wiring(uint8_t data_start, uint8_t rs, uint8_t rw, uint8_t e);
+uint8_t sim_lcd_ddram(uint8_t line, uint8_t column); // DDRAM, column 0-39
+uint8_t sim_lcd_screen(uint8_t row, uint8_t column); // What is shown, after the display shift
+uint8_t sim_lcd_cgram(uint8_t address);
+unsigned long sim_lcd_bytes(void); // Bytes the LCD executed
+unsigned long sim_lcd_errors(void); // Bytes sent while busy and short E pulses
+void sim_motor_wiring(uint8_t m0, uint8_t m1, uint8_t m2, uint8_t m3);
+
+uint8_t sim_eeprom_read(uint16_t address);
+void sim_eeprom_write(uint16_t address, uint8_t value);
+uint8_t sim_eeprom_ready(void);
+
+#endif // SIM_H
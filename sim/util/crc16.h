@@ -0,0 +1,21 @@
+#ifndef SIM_UTIL_CRC16_H
+#define SIM_UTIL_CRC16_H
+
+#include <stdint.h>
+
+// C equivalents from the avr-libc documentation
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t data)
+{
+	crc ^= data;
+	for(uint8_t i = 0; i < 8; i++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	return crc;
+}
+
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+	data ^= crc;
+	for(uint8_t i = 0; i < 8; i++) data = (data & 0x80) ? (data << 1) ^ 0x07 : data << 1;
+	return data;
+}
+
+#endif // SIM_UTIL_CRC16_H
@@ -0,0 +1,16 @@
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include "sim.h"
+
+static inline void _delay_ms(double ms)
+{
+	sim_cycles(ms * (F_CPU / 1e3)); // Delay loops count cycles, RC errors stretch them
+}
+
+static inline void _delay_us(double us)
+{
+	sim_cycles(us * (F_CPU / 1e6));
+}
+
+#endif // SIM_UTIL_DELAY_H
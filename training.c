@@ -1,3 +1,4 @@
+#include "hal.h"
 #include <avr/io.h>
 #include <util/delay.h>
 #include "OnLCDLib.h"
@@ -23,11 +24,13 @@
 #define ROT 16
 #define RIGHT 1
 #define LEFT 0
+#define STEP_MODE MOTOR_WAVE // MOTOR_WAVE, MOTOR_FULL or MOTOR_HALF (needs 2x ROT)
+
+#include "motor.h"
 
 void initMotor(void)
 {
-	DDRB = 0xFF; // all B as output
-    PORTB = 0x00; // all low
+	motor_init(); // only M0..M3 become outputs
 }
 
 void initButton(void)
@@ -35,54 +38,27 @@ void initButton(void)
 	DDRB &= ~(1 << BUTTON);
 } 
 
-void rotate(uint8_t direction)
-{	
-	uint16_t i;
-	for(i = 0; i < ROT; i++)
-	{
-		if(direction == RIGHT)
-		{
-			PORTB = M0;
-			_delay_us(MDELAY);
-			PORTB = M1;
-			_delay_us(MDELAY);
-			PORTB = M2;
-			_delay_us(MDELAY);
-			PORTB = M3;
-			_delay_us(MDELAY);
-		}
-		else
-		{
-			PORTB = M3;
-			_delay_us(MDELAY);
-			PORTB = M2;
-			_delay_us(MDELAY);
-			PORTB = M1;
-			_delay_us(MDELAY);
-			PORTB = M0;
-			_delay_us(MDELAY);
-		}
-	}
-}
-
 int main(void)
 {	
 	initMotor();
+	sei();
 	
     LCDSetup(LCD_CURSOR_ULINE);
  
     while(1)
     {		
         LCDGotoXY(1, 1);
-		LCDWriteString("TRAINING");
+		LCDWriteString_P(PSTR("TRAINING"));
 		
 		if(PIN & (1 << BUTTON))
 		{			
-			rotate(LEFT);
+			motor_move_mode(LEFT, ROT * 4, STEP_MODE);
+			while(motor_busy()) HAL_WAIT();
 
-			rotate(RIGHT);
+			motor_move_mode(RIGHT, ROT * 4, STEP_MODE);
+			while(motor_busy()) HAL_WAIT();
 			
-			PORTB &= (1 << BUTTON);
+			motor_release();
 			
 			_delay_ms(500);
 		}